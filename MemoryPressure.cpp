@@ -0,0 +1,153 @@
+#include "VirtualMemoryExtensions.h"
+#include "VirtualMemoryInternal.h"
+
+#include <chrono>
+#include <cmath>
+
+// The averages are updated once per period, over the same windows as the kernel's PSI
+#define PRESSURE_PERIOD 2000000
+#define NUM_PRESSURE_AVERAGES 3
+#define MAX_PRESSURE_TRIGGERS 8
+
+struct PressureTrigger {
+    bool active;
+    long long int stallThreshold;
+    long long int window;
+    PressureCallback callback;
+    void *context;
+    // When the current window started, the total stall time then, and the stall time of the window
+    // before it
+    long long int windowStart;
+    long long int windowStartStall;
+    long long int previousWindowStall;
+    bool firedInWindow;
+};
+
+static const double averageWindows[NUM_PRESSURE_AVERAGES] = {10000000.0, 60000000.0, 300000000.0};
+static double averages[NUM_PRESSURE_AVERAGES] = {0, 0, 0};
+static long long int totalStall = 0;
+static long long int periodStart = -1;
+static long long int periodStartStall = 0;
+static PressureTrigger triggers[MAX_PRESSURE_TRIGGERS];
+
+long long int pressureClock() {
+    return (long long int)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * This function folds the periods which ended by now into the averages. The stall time since the
+ * last update all goes to the first of them, the others (if the library was idle) had none.
+ * @param now The current time.
+ */
+void updateAverages(long long int now) {
+    if (periodStart == -1) {
+        periodStart = now;
+    }
+    long long int numPeriods = (now - periodStart) / PRESSURE_PERIOD;
+    if (numPeriods == 0) {
+        return;
+    }
+    double share = (double)(totalStall - periodStartStall) / PRESSURE_PERIOD;
+    if (share > 1) {
+        share = 1;
+    }
+    for (int i = 0; i < NUM_PRESSURE_AVERAGES; i++) {
+        double decay = std::exp(-PRESSURE_PERIOD / averageWindows[i]);
+        averages[i] = averages[i] * decay + share * 100 * (1 - decay);
+        averages[i] *= std::pow(decay, (double)(numPeriods - 1));
+    }
+    periodStart += numPeriods * PRESSURE_PERIOD;
+    periodStartStall = totalStall;
+}
+
+/**
+ * This function fires the triggers whose stall time over the last window reached their threshold,
+ * at most once per window. Like the kernel's PSI triggers, the window slides by counting the part
+ * of the previous window it still overlaps as if its stall time were spread evenly.
+ * @param now The current time.
+ */
+void checkTriggers(long long int now) {
+    for (int i = 0; i < MAX_PRESSURE_TRIGGERS; i++) {
+        PressureTrigger &trigger = triggers[i];
+        if (!trigger.active) {
+            continue;
+        }
+        long long int elapsed = now - trigger.windowStart;
+        if (elapsed >= trigger.window) {
+            trigger.previousWindowStall = elapsed < 2 * trigger.window ?
+                                          totalStall - trigger.windowStartStall : 0;
+            trigger.windowStart = now;
+            trigger.windowStartStall = totalStall;
+            trigger.firedInWindow = false;
+            elapsed = 0;
+        }
+        long long int stall = totalStall - trigger.windowStartStall +
+                              trigger.previousWindowStall * (trigger.window - elapsed) /
+                              trigger.window;
+        if (!trigger.firedInWindow && stall >= trigger.stallThreshold) {
+            trigger.firedInWindow = true;
+            trigger.callback(trigger.context);
+        }
+    }
+}
+
+void recordStall(long long int stallStart) {
+    long long int now = pressureClock();
+    totalStall += now - stallStart;
+    updateAverages(now);
+    checkTriggers(now);
+}
+
+void resetPressure() {
+    for (int i = 0; i < NUM_PRESSURE_AVERAGES; i++) {
+        averages[i] = 0;
+    }
+    totalStall = 0;
+    periodStart = pressureClock();
+    periodStartStall = 0;
+    for (int i = 0; i < MAX_PRESSURE_TRIGGERS; i++) {
+        triggers[i].windowStart = periodStart;
+        triggers[i].windowStartStall = 0;
+        triggers[i].previousWindowStall = 0;
+        triggers[i].firedInWindow = false;
+    }
+}
+
+void VMgetPressure(double *avg10, double *avg60, double *avg300, long long int *total) {
+    updateAverages(pressureClock());
+    *avg10 = averages[0];
+    *avg60 = averages[1];
+    *avg300 = averages[2];
+    *total = totalStall;
+}
+
+int VMaddPressureTrigger(long long int stallThreshold, long long int window,
+                         PressureCallback callback, void *context) {
+    if (callback == nullptr || window <= 0 || stallThreshold <= 0 || stallThreshold > window) {
+        return -1;
+    }
+    for (int i = 0; i < MAX_PRESSURE_TRIGGERS; i++) {
+        PressureTrigger &trigger = triggers[i];
+        if (trigger.active) {
+            continue;
+        }
+        trigger.active = true;
+        trigger.stallThreshold = stallThreshold;
+        trigger.window = window;
+        trigger.callback = callback;
+        trigger.context = context;
+        trigger.windowStart = pressureClock();
+        trigger.windowStartStall = totalStall;
+        trigger.previousWindowStall = 0;
+        trigger.firedInWindow = false;
+        return i;
+    }
+    return -1;
+}
+
+void VMremovePressureTrigger(int trigger) {
+    if (trigger >= 0 && trigger < MAX_PRESSURE_TRIGGERS) {
+        triggers[trigger].active = false;
+    }
+}
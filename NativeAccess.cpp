@@ -0,0 +1,299 @@
+#include "NativeAccess.h"
+#include "PhysicalMemory.h"
+#include "VirtualMemoryInternal.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define REGION_BYTES (VIRTUAL_MEMORY_SIZE * sizeof(word_t))
+
+static word_t *region = nullptr;
+static int faultDescriptor = -1;
+static int stopPipe[2] = {-1, -1};
+static std::thread handlerThread;
+// The pages currently mirrored in the region, and the ones written since they were mirrored
+static std::vector<bool> mirroredPages;
+static std::vector<bool> dirtyPages;
+static bool trackDirtyPages = false;
+static struct sigaction previousAction;
+static word_t pageBuffer[PAGE_SIZE];
+
+/**
+ * This function writes a mirrored page back to its frame before it is evicted, and drops it from
+ * the region so its next access faults again.
+ * @param pageNumber The evicted page.
+ * @param frameIndex The frame it is evicted from.
+ */
+void writeBackPage(uint64_t pageNumber, uint64_t frameIndex) {
+    if (!mirroredPages[pageNumber]) {
+        return;
+    }
+    word_t *page = region + (pageNumber << OFFSET_WIDTH);
+    if (!trackDirtyPages || dirtyPages[pageNumber]) {
+        for (int offset = 0; offset < PAGE_SIZE; offset++) {
+            PMwrite(frameIndex * PAGE_SIZE + offset, page[offset]);
+        }
+    }
+    if (trackDirtyPages) {
+        mprotect(page, PAGE_BYTES, PROT_NONE);
+        dirtyPages[pageNumber] = false;
+    }
+    madvise(page, PAGE_BYTES, MADV_DONTNEED);
+    mirroredPages[pageNumber] = false;
+}
+
+/**
+ * This function faults in the page containing a faulting host address and copies it into the
+ * region, which also wakes the faulting thread.
+ * @param faultAddress The host address.
+ */
+void handleFault(uint64_t faultAddress) {
+    uint64_t virtualAddress = (faultAddress - (uint64_t)region) / sizeof(word_t);
+    uint64_t pageNumber = virtualAddress >> OFFSET_WIDTH;
+    uint64_t pageAddress = translateVirtualAddress(pageNumber << OFFSET_WIDTH);
+    for (int offset = 0; offset < PAGE_SIZE; offset++) {
+        PMread(pageAddress + offset, &pageBuffer[offset]);
+    }
+    struct uffdio_copy copy;
+    copy.dst = (uint64_t)(region + (pageNumber << OFFSET_WIDTH));
+    copy.src = (uint64_t)pageBuffer;
+    copy.len = PAGE_BYTES;
+    copy.mode = 0;
+    if (ioctl(faultDescriptor, UFFDIO_COPY, &copy) == -1) {
+        if (errno != EEXIST) {
+            systemError("UFFDIO_COPY");
+        }
+        // Another host page of the same page was copied first, so only wake the thread
+        struct uffdio_range range;
+        range.start = copy.dst;
+        range.len = PAGE_BYTES;
+        ioctl(faultDescriptor, UFFDIO_WAKE, &range);
+    }
+    mirroredPages[pageNumber] = true;
+}
+
+/**
+ * This function is the handler thread's loop, serving faults until it is told to stop.
+ */
+void serveFaults() {
+    struct pollfd descriptors[2];
+    descriptors[0].fd = faultDescriptor;
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = stopPipe[0];
+    descriptors[1].events = POLLIN;
+    while (true) {
+        if (poll(descriptors, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            systemError("poll");
+        }
+        if (descriptors[1].revents & POLLIN) {
+            return;
+        }
+        struct uffd_msg message;
+        if (read(faultDescriptor, &message, sizeof(message)) != sizeof(message)) {
+            continue;
+        }
+        if (message.event == UFFD_EVENT_PAGEFAULT) {
+            handleFault(message.arg.pagefault.address);
+        }
+    }
+}
+
+/**
+ * This function is the SIGSEGV handler of the mprotect-based mode. An access to a page which is not
+ * mirrored faults it in and maps it read-only; a write to a read-only page then traps again and
+ * makes it writable and dirty. Faults outside the region go to the previous handler.
+ * @param signalNumber The signal.
+ * @param info The faulting address.
+ * @param context The interrupted context.
+ */
+void handleProtectionFault(int signalNumber, siginfo_t *info, void *context) {
+    uint64_t faultAddress = (uint64_t)info->si_addr;
+    if (region == nullptr || faultAddress < (uint64_t)region ||
+        faultAddress >= (uint64_t)region + REGION_BYTES) {
+        if (previousAction.sa_flags & SA_SIGINFO) {
+            previousAction.sa_sigaction(signalNumber, info, context);
+        }
+        else if (previousAction.sa_handler != SIG_DFL && previousAction.sa_handler != SIG_IGN) {
+            previousAction.sa_handler(signalNumber);
+        }
+        else { // Let the access fault again with the default action
+            signal(SIGSEGV, SIG_DFL);
+        }
+        return;
+    }
+    uint64_t pageNumber = (faultAddress - (uint64_t)region) / PAGE_BYTES;
+    word_t *page = region + (pageNumber << OFFSET_WIDTH);
+    if (mirroredPages[pageNumber]) {
+        mprotect(page, PAGE_BYTES, PROT_READ | PROT_WRITE);
+        dirtyPages[pageNumber] = true;
+        return;
+    }
+    uint64_t pageAddress = translateVirtualAddress(pageNumber << OFFSET_WIDTH);
+    mprotect(page, PAGE_BYTES, PROT_READ | PROT_WRITE);
+    for (int offset = 0; offset < PAGE_SIZE; offset++) {
+        PMread(pageAddress + offset, &page[offset]);
+    }
+    mprotect(page, PAGE_BYTES, PROT_READ);
+    mirroredPages[pageNumber] = true;
+}
+
+/**
+ * This function writes the mirrored pages which may differ from their frames back, before a mode
+ * is turned off. Mirrored pages are resident, so translating them only walks the tree.
+ */
+void writeBackAllPages() {
+    for (uint64_t pageNumber = 0; pageNumber < NUM_PAGES; pageNumber++) {
+        if (mirroredPages[pageNumber] && (!trackDirtyPages || dirtyPages[pageNumber])) {
+            uint64_t pageAddress = translateVirtualAddress(pageNumber << OFFSET_WIDTH);
+            const word_t *page = region + (pageNumber << OFFSET_WIDTH);
+            for (int offset = 0; offset < PAGE_SIZE; offset++) {
+                PMwrite(pageAddress + offset, page[offset]);
+            }
+        }
+    }
+}
+
+/**
+ * This function releases whatever VMmapNative or VMmapProtected managed to set up.
+ */
+void releaseNative() {
+    if (region != nullptr) {
+        munmap(region, REGION_BYTES);
+        region = nullptr;
+    }
+    if (faultDescriptor != -1) {
+        close(faultDescriptor);
+        faultDescriptor = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (stopPipe[i] != -1) {
+            close(stopPipe[i]);
+            stopPipe[i] = -1;
+        }
+    }
+    mirroredPages.clear();
+    dirtyPages.clear();
+    trackDirtyPages = false;
+}
+
+/**
+ * This function reserves the host region, if the geometry allows mirroring it.
+ * @param protection The initial protection of the region.
+ * @return true on success, false with errno set otherwise.
+ */
+bool reserveRegion(int protection) {
+    long hostPageSize = sysconf(_SC_PAGESIZE);
+    if (region != nullptr || hostPageSize <= 0 || PAGE_BYTES % hostPageSize != 0) {
+        errno = EINVAL;
+        return false;
+    }
+    void *mapping = mmap(nullptr, REGION_BYTES, protection,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    region = (word_t *)mapping;
+    mirroredPages.assign(NUM_PAGES, false);
+    return true;
+}
+
+/**
+ * This function stops the handler thread of the userfaultfd mode, if it runs.
+ */
+void stopHandlerThread() {
+    if (!handlerThread.joinable()) {
+        return;
+    }
+    char stop = 0;
+    if (write(stopPipe[1], &stop, 1) == 1) {
+        handlerThread.join();
+    }
+    else {
+        handlerThread.detach();
+    }
+}
+
+word_t *VMmapNative() {
+    if (!reserveRegion(PROT_READ | PROT_WRITE)) {
+        return nullptr;
+    }
+    faultDescriptor = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = 0;
+    struct uffdio_register registration;
+    registration.range.start = (uint64_t)region;
+    registration.range.len = REGION_BYTES;
+    registration.mode = UFFDIO_REGISTER_MODE_MISSING;
+    if (faultDescriptor == -1 || ioctl(faultDescriptor, UFFDIO_API, &api) == -1 ||
+        ioctl(faultDescriptor, UFFDIO_REGISTER, &registration) == -1 || pipe(stopPipe) == -1) {
+        int error = errno;
+        releaseNative();
+        errno = error;
+        return nullptr;
+    }
+    setNativeAccess(region, writeBackPage);
+    handlerThread = std::thread(serveFaults);
+    // A joinable thread must not be destroyed with the statics, so one still running at exit is
+    // stopped first
+    static bool stopRegistered = false;
+    if (!stopRegistered) {
+        atexit(stopHandlerThread);
+        stopRegistered = true;
+    }
+    return region;
+}
+
+void VMunmapNative() {
+    if (region == nullptr || trackDirtyPages) {
+        return;
+    }
+    stopHandlerThread();
+    setNativeAccess(nullptr, nullptr);
+    writeBackAllPages();
+    releaseNative();
+}
+
+word_t *VMmapProtected() {
+    if (!reserveRegion(PROT_NONE)) {
+        return nullptr;
+    }
+    struct sigaction action;
+    action.sa_sigaction = handleProtectionFault;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    if (sigaction(SIGSEGV, &action, &previousAction) == -1) {
+        int error = errno;
+        releaseNative();
+        errno = error;
+        return nullptr;
+    }
+    dirtyPages.assign(NUM_PAGES, false);
+    trackDirtyPages = true;
+    setNativeAccess(region, writeBackPage);
+    return region;
+}
+
+void VMunmapProtected() {
+    if (region == nullptr || !trackDirtyPages) {
+        return;
+    }
+    setNativeAccess(nullptr, nullptr);
+    // Written pages are writable, so reading them back does not trap
+    writeBackAllPages();
+    sigaction(SIGSEGV, &previousAction, nullptr);
+    releaseNative();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "MemoryConstants.h"
+
+/**
+ * Native-speed access modes. The virtual memory is mirrored by a host region in which the resident
+ * pages are real host memory, so accessing them is a plain load or store. The first access to a
+ * page which is not mirrored is trapped, faulted in through the usual paging and eviction logic and
+ * copied into the region. Evicted pages are written back to their frame and dropped from the
+ * region, so they trap again on next access.
+ *
+ * A library page must span whole host pages (PAGE_SIZE * sizeof(word_t) a multiple of the host
+ * page size). Only one mode may be on at a time. While it is on, VMread/VMwrite go through the
+ * region as well, and only one thread at a time may access the region, since a page written by
+ * another thread while it is being evicted may lose that write. The region and its bookkeeping
+ * span the whole virtual memory, so these modes are for virtual memories the host can map whole,
+ * unlike the 48 or 57 bit ones the library otherwise handles.
+ */
+
+/**
+ * This function turns native access on, with missing pages delivered through userfaultfd to a
+ * handler thread. It must be called after VMinitialize.
+ * @return The region, VIRTUAL_MEMORY_SIZE words long, or nullptr (with errno set) if the mode is
+ * not supported or could not be set up.
+ */
+word_t *VMmapNative();
+
+/**
+ * This function turns native access off, writing the mirrored pages back to their frames.
+ * The region returned by VMmapNative is no longer valid afterwards. If the program exits with the
+ * mode on, the handler thread is stopped at exit without writing the pages back.
+ */
+void VMunmapNative();
+
+/**
+ * This function turns native access on, with pages trapped through mprotect and a SIGSEGV
+ * handler running in the accessing thread. A page is mapped read-only on its first access and
+ * made writable on its first write, so only pages written since they were faulted in are written
+ * back. It must be called after VMinitialize, and the accesses must not come from a context in
+ * which PMread/PMwrite/PMevict/PMrestore cannot run (e.g. another signal handler).
+ * @return The region, VIRTUAL_MEMORY_SIZE words long, or nullptr (with errno set) if the mode is
+ * not supported or could not be set up.
+ */
+word_t *VMmapProtected();
+
+/**
+ * This function turns mprotect-based access off, writing the written pages back to their frames.
+ * The region returned by VMmapProtected is no longer valid afterwards.
+ */
+void VMunmapProtected();
@@ -0,0 +1,534 @@
+#include "PhysicalMemory.h"
+#include "VirtualMemoryInternal.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * A physical memory whose swap is a local file accessed through io_uring, to be linked instead of
+ * the in-memory PhysicalMemory.cpp. The swap may be striped over several files, e.g. on different
+ * devices: VM_SWAP_FILE holds their paths separated by ':', and otherwise VM_SWAP_STRIPES unlinked
+ * temporary files are used (one by default). An evicted page takes a free swap slot, which it gives
+ * back once restored, so the files grow with the pages in swap rather than with the virtual
+ * memory. Slot s lives in file s % stripes at offset s / stripes, or with VM_SWAP_STRIPE_HASH=1 in
+ * the file a hash of s picks, at offset s. The evictions take their slots from the stripes in turn.
+ *
+ * The RAM and a ring of staging slots are registered buffers, and the swap files are fixed files.
+ * PMevict copies the frame to a free staging slot and queues its write, submitting the queue once
+ * SWAP_SUBMIT_BATCH writes wait in it, so evictions complete asynchronously while the frame is
+ * reused. PMrestore serves a page whose write is still in flight from its staging slot, and
+ * otherwise reads it straight into the frame, submitting the queued writes along with the read.
+ * PMqueueRestore starts such a read without waiting for it, so the reads of a batch of restores
+ * proceed in parallel on their stripes until PMwaitRestores.
+ *
+ * Setting VM_SWAP_DIRECT=1 opens the swap file with O_DIRECT, so swapped pages are not also cached
+ * in host RAM. Every transfer is then SWAP_DIRECT_ALIGNMENT aligned: swap slots are padded to a
+ * multiple of it, and when a page is smaller than a slot it is read through a reserved staging
+ * slot instead of straight into its frame, one read at a time.
+ *
+ * Restored pages are copied into their frame, and frames are zeroed (PMzeroFrame), with
+ * non-temporal stores where SSE2 is available, so bulk copies do not evict the hot table rows from
+ * the host CPU caches.
+ */
+
+#ifndef SWAP_STAGING_SLOTS
+#define SWAP_STAGING_SLOTS 64
+#endif
+#ifndef SWAP_SUBMIT_BATCH
+#define SWAP_SUBMIT_BATCH 16
+#endif
+#ifndef SWAP_DIRECT_ALIGNMENT
+#define SWAP_DIRECT_ALIGNMENT 4096
+#endif
+#define SWAP_QUEUE_DEPTH (2 * SWAP_STAGING_SLOTS)
+#define READ_SLOT SWAP_STAGING_SLOTS
+#define RAM_BUFFER 0
+#define STAGING_BUFFER 1
+// Set in the tag of reads, whose completion carries their frame
+#define READ_REQUEST (1ULL << 63)
+
+struct SubmissionQueue {
+    unsigned *head;
+    unsigned *tail;
+    unsigned *ringMask;
+    unsigned *array;
+    struct io_uring_sqe *entries;
+};
+
+struct CompletionQueue {
+    unsigned *head;
+    unsigned *tail;
+    unsigned *ringMask;
+    struct io_uring_cqe *entries;
+};
+
+static word_t *ram = nullptr;
+static char *staging = nullptr;
+static bool directTransfers = false;
+static size_t slotBytes = PAGE_BYTES;
+static int ringDescriptor = -1;
+static std::vector<int> swapDescriptors;
+static bool hashStripes = false;
+static SubmissionQueue submissionQueue;
+static CompletionQueue completionQueue;
+static unsigned numQueued = 0;
+// The swap slot of each page in swap, and of each frame with a read in flight
+static std::unordered_map<uint64_t, uint64_t> swapSlots;
+static std::unordered_map<uint64_t, uint64_t> readSwapSlots;
+// The swap slots given back and the slots taken so far, by stripe (by all stripes when hashed),
+// and the stripe the next eviction takes a slot from
+static std::vector<std::vector<uint64_t> > freeSwapSlots;
+static std::vector<uint64_t> stripeSlotCounts;
+static uint64_t numSwapSlots = 0;
+static unsigned nextStripe = 0;
+// For each staging slot with a write in flight: the page (-1 for free slots), the swap slot
+// written, and whether the page was restored meanwhile, so the slot is given back once it lands
+static long long int slotPages[SWAP_STAGING_SLOTS];
+static uint64_t slotSwapSlots[SWAP_STAGING_SLOTS];
+static bool slotReleases[SWAP_STAGING_SLOTS];
+
+/**
+ * This function copies whole frames' worth of bytes without bringing the destination into the
+ * host CPU caches, falling back to memcpy when the buffers are not 16 byte aligned.
+ * @param destination The destination.
+ * @param source The source.
+ * @param numBytes The number of bytes.
+ */
+void streamCopy(void *destination, const void *source, size_t numBytes) {
+#ifdef __SSE2__
+    if (((uintptr_t)destination | (uintptr_t)source | numBytes) % sizeof(__m128i) == 0) {
+        __m128i *to = (__m128i *)destination;
+        const __m128i *from = (const __m128i *)source;
+        for (size_t i = 0; i < numBytes / sizeof(__m128i); i++) {
+            _mm_stream_si128(to + i, _mm_load_si128(from + i));
+        }
+        // Streaming stores are weakly ordered, so they must land before the frame is used
+        _mm_sfence();
+        return;
+    }
+#endif
+    memcpy(destination, source, numBytes);
+}
+
+/**
+ * This function zeroes bytes without bringing them into the host CPU caches, falling back to memset
+ * when they are not 16 byte aligned.
+ * @param destination The destination.
+ * @param numBytes The number of bytes.
+ */
+void streamZero(void *destination, size_t numBytes) {
+#ifdef __SSE2__
+    if (((uintptr_t)destination | numBytes) % sizeof(__m128i) == 0) {
+        __m128i *to = (__m128i *)destination;
+        __m128i zero = _mm_setzero_si128();
+        for (size_t i = 0; i < numBytes / sizeof(__m128i); i++) {
+            _mm_stream_si128(to + i, zero);
+        }
+        _mm_sfence();
+        return;
+    }
+#endif
+    memset(destination, 0, numBytes);
+}
+
+/**
+ * This function maps the rings of a new io_uring instance.
+ * @param parameters The parameters io_uring_setup returned.
+ */
+void mapRings(const struct io_uring_params &parameters) {
+    size_t submissionBytes = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+    size_t completionBytes = parameters.cq_off.cqes +
+                             parameters.cq_entries * sizeof(struct io_uring_cqe);
+    char *submissionRing = (char *)mmap(nullptr, submissionBytes, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ringDescriptor,
+                                        IORING_OFF_SQ_RING);
+    char *completionRing = (char *)mmap(nullptr, completionBytes, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ringDescriptor,
+                                        IORING_OFF_CQ_RING);
+    void *entries = mmap(nullptr, parameters.sq_entries * sizeof(struct io_uring_sqe),
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor,
+                         IORING_OFF_SQES);
+    if (submissionRing == MAP_FAILED || completionRing == MAP_FAILED || entries == MAP_FAILED) {
+        systemError("mmap io_uring");
+    }
+    submissionQueue.head = (unsigned *)(submissionRing + parameters.sq_off.head);
+    submissionQueue.tail = (unsigned *)(submissionRing + parameters.sq_off.tail);
+    submissionQueue.ringMask = (unsigned *)(submissionRing + parameters.sq_off.ring_mask);
+    submissionQueue.array = (unsigned *)(submissionRing + parameters.sq_off.array);
+    submissionQueue.entries = (struct io_uring_sqe *)entries;
+    completionQueue.head = (unsigned *)(completionRing + parameters.cq_off.head);
+    completionQueue.tail = (unsigned *)(completionRing + parameters.cq_off.tail);
+    completionQueue.ringMask = (unsigned *)(completionRing + parameters.cq_off.ring_mask);
+    completionQueue.entries = (struct io_uring_cqe *)(completionRing + parameters.cq_off.cqes);
+}
+
+/**
+ * This function opens a swap file, or an unlinked temporary file.
+ * @param path The path of the file, nullptr for a temporary file.
+ * @return The file descriptor.
+ */
+int openSwapFile(const char *path) {
+    int flags = O_CLOEXEC | (directTransfers ? O_DIRECT : 0);
+    int descriptor;
+    if (path != nullptr) {
+        descriptor = open(path, O_RDWR | O_CREAT | O_TRUNC | flags, 0600);
+    }
+    else {
+        char temporaryPath[] = "/tmp/vm-swap-XXXXXX";
+        descriptor = mkostemp(temporaryPath, flags);
+        if (descriptor != -1) {
+            unlink(temporaryPath);
+        }
+    }
+    if (descriptor == -1) {
+        systemError("open swap file");
+    }
+    return descriptor;
+}
+
+/**
+ * This function opens the swap stripes, from VM_SWAP_FILE or VM_SWAP_STRIPES.
+ */
+void openSwapFiles() {
+    const char *paths = getenv("VM_SWAP_FILE");
+    if (paths != nullptr) {
+        std::string remaining(paths);
+        size_t separator;
+        do {
+            separator = remaining.find(':');
+            swapDescriptors.push_back(openSwapFile(remaining.substr(0, separator).c_str()));
+            remaining.erase(0, separator == std::string::npos ? separator : separator + 1);
+        } while (separator != std::string::npos);
+        return;
+    }
+    const char *stripes = getenv("VM_SWAP_STRIPES");
+    int numStripes = stripes != nullptr ? atoi(stripes) : 1;
+    for (int stripe = 0; stripe < (numStripes > 0 ? numStripes : 1); stripe++) {
+        swapDescriptors.push_back(openSwapFile(nullptr));
+    }
+}
+
+/**
+ * This function finds the stripe holding a swap slot.
+ * @param swapSlot The swap slot.
+ * @return The index of the stripe's file.
+ */
+unsigned getStripe(uint64_t swapSlot) {
+    if (hashStripes) {
+        uint64_t hash = swapSlot * 0x9E3779B97F4A7C15ULL;
+        return (unsigned)((hash >> 32) % swapDescriptors.size());
+    }
+    return (unsigned)(swapSlot % swapDescriptors.size());
+}
+
+/**
+ * This function finds the offset of a swap slot within its stripe.
+ * @param swapSlot The swap slot.
+ * @return The offset in bytes.
+ */
+uint64_t getStripeOffset(uint64_t swapSlot) {
+    if (hashStripes) {
+        return swapSlot * slotBytes;
+    }
+    return swapSlot / swapDescriptors.size() * slotBytes;
+}
+
+/**
+ * This function sets up the RAM, the staging slots, the swap file and the io_uring instance, and
+ * registers the buffers and the file with it.
+ */
+void initializeSwap() {
+    const char *direct = getenv("VM_SWAP_DIRECT");
+    directTransfers = direct != nullptr && strcmp(direct, "0") != 0;
+    if (directTransfers) {
+        slotBytes = (PAGE_BYTES + SWAP_DIRECT_ALIGNMENT - 1) / SWAP_DIRECT_ALIGNMENT *
+                    SWAP_DIRECT_ALIGNMENT;
+    }
+    // One more slot than the writes use, for reads which cannot go straight into a frame
+    if (posix_memalign((void **)&ram, SWAP_DIRECT_ALIGNMENT, NUM_FRAMES * PAGE_BYTES) != 0 ||
+        posix_memalign((void **)&staging, SWAP_DIRECT_ALIGNMENT,
+                       (SWAP_STAGING_SLOTS + 1) * slotBytes) != 0) {
+        std::cerr << "system error: cannot allocate physical memory" << std::endl;
+        exit(1);
+    }
+    memset(ram, 0, NUM_FRAMES * PAGE_BYTES);
+    const char *hash = getenv("VM_SWAP_STRIPE_HASH");
+    hashStripes = hash != nullptr && strcmp(hash, "0") != 0;
+    openSwapFiles();
+    struct io_uring_params parameters;
+    memset(&parameters, 0, sizeof(parameters));
+    ringDescriptor = (int)syscall(__NR_io_uring_setup, SWAP_QUEUE_DEPTH, &parameters);
+    if (ringDescriptor == -1) {
+        systemError("io_uring_setup");
+    }
+    mapRings(parameters);
+    struct iovec buffers[2];
+    buffers[RAM_BUFFER].iov_base = ram;
+    buffers[RAM_BUFFER].iov_len = NUM_FRAMES * PAGE_BYTES;
+    buffers[STAGING_BUFFER].iov_base = staging;
+    buffers[STAGING_BUFFER].iov_len = (SWAP_STAGING_SLOTS + 1) * slotBytes;
+    if (syscall(__NR_io_uring_register, ringDescriptor, IORING_REGISTER_BUFFERS, buffers, 2) ||
+        syscall(__NR_io_uring_register, ringDescriptor, IORING_REGISTER_FILES,
+                swapDescriptors.data(), (unsigned)swapDescriptors.size())) {
+        systemError("io_uring_register");
+    }
+    swapSlots.clear();
+    readSwapSlots.clear();
+    freeSwapSlots.assign(swapDescriptors.size(), std::vector<uint64_t>());
+    stripeSlotCounts.assign(swapDescriptors.size(), 0);
+    numSwapSlots = 0;
+    nextStripe = 0;
+    for (int slot = 0; slot < SWAP_STAGING_SLOTS; slot++) {
+        slotPages[slot] = -1;
+    }
+}
+
+/**
+ * This function takes a swap slot for an evicted page, from the stripes in turn so consecutive
+ * evictions go to different files: one the stripe was given back, or else a new one.
+ * @return The swap slot.
+ */
+uint64_t takeSwapSlot() {
+    unsigned stripe = nextStripe;
+    nextStripe = (nextStripe + 1) % (unsigned)swapDescriptors.size();
+    std::vector<uint64_t> &freeSlots = freeSwapSlots[stripe];
+    if (!freeSlots.empty()) {
+        uint64_t swapSlot = freeSlots.back();
+        freeSlots.pop_back();
+        return swapSlot;
+    }
+    if (hashStripes) { // A new slot goes to the stripe its hash picks
+        return numSwapSlots++;
+    }
+    return stripeSlotCounts[stripe]++ * swapDescriptors.size() + stripe;
+}
+
+/**
+ * This function gives a swap slot back to its stripe.
+ * @param swapSlot The swap slot.
+ */
+void releaseSwapSlot(uint64_t swapSlot) {
+    freeSwapSlots[getStripe(swapSlot)].push_back(swapSlot);
+}
+
+/**
+ * This function handles the completions posted so far: finished writes free their staging slot,
+ * and finished reads their swap slot.
+ */
+void reapCompletions() {
+    unsigned head = *completionQueue.head;
+    unsigned tail = __atomic_load_n(completionQueue.tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe &completion = completionQueue.entries[head &
+                                                                       *completionQueue.ringMask];
+        if (completion.res != (int)slotBytes) {
+            errno = completion.res < 0 ? -completion.res : EIO;
+            systemError(completion.user_data & READ_REQUEST ? "swap read" : "swap write");
+        }
+        if (completion.user_data & READ_REQUEST) {
+            std::unordered_map<uint64_t, uint64_t>::iterator read =
+                readSwapSlots.find(completion.user_data & ~READ_REQUEST);
+            releaseSwapSlot(read->second);
+            readSwapSlots.erase(read);
+            continue;
+        }
+        int slot = (int)completion.user_data;
+        if (slotReleases[slot]) {
+            releaseSwapSlot(slotSwapSlots[slot]);
+        }
+        slotPages[slot] = -1;
+    }
+    __atomic_store_n(completionQueue.head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * This function submits the queued requests, and waits until at least minComplete of them finish.
+ * @param minComplete The number of completions to wait for.
+ */
+void submitQueued(unsigned minComplete) {
+    unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (syscall(__NR_io_uring_enter, ringDescriptor, numQueued, minComplete, flags,
+                   nullptr, 0) == -1) {
+        if (errno != EINTR) {
+            systemError("io_uring_enter");
+        }
+    }
+    numQueued = 0;
+    reapCompletions();
+}
+
+/**
+ * This function queues a read or write of a swap slot on its fixed stripe file.
+ * @param operation IORING_OP_READ_FIXED or IORING_OP_WRITE_FIXED.
+ * @param buffer The registered buffer holding address.
+ * @param address The memory read into or written from, slotBytes long.
+ * @param swapSlot The swap slot.
+ * @param userData The tag of the request's completion.
+ */
+void queueRequest(uint8_t operation, uint16_t buffer, void *address, uint64_t swapSlot,
+                  uint64_t userData) {
+    unsigned tail = *submissionQueue.tail;
+    unsigned index = tail & *submissionQueue.ringMask;
+    struct io_uring_sqe &entry = submissionQueue.entries[index];
+    memset(&entry, 0, sizeof(entry));
+    entry.opcode = operation;
+    entry.flags = IOSQE_FIXED_FILE;
+    entry.fd = (int32_t)getStripe(swapSlot);
+    entry.addr = (uint64_t)address;
+    entry.len = (uint32_t)slotBytes;
+    entry.off = getStripeOffset(swapSlot);
+    entry.buf_index = buffer;
+    entry.user_data = userData;
+    submissionQueue.array[index] = index;
+    __atomic_store_n(submissionQueue.tail, tail + 1, __ATOMIC_RELEASE);
+    numQueued++;
+}
+
+/**
+ * This function finds the staging slot holding a page whose write is in flight.
+ * @param pageNumber The page.
+ * @return The slot, -1 if no write of the page is in flight.
+ */
+int findPageSlot(uint64_t pageNumber) {
+    for (int slot = 0; slot < SWAP_STAGING_SLOTS; slot++) {
+        if (slotPages[slot] == (long long int)pageNumber) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/**
+ * This function waits until a staging slot is free, and takes it.
+ * @return The slot.
+ */
+int acquireSlot() {
+    while (true) {
+        for (int slot = 0; slot < SWAP_STAGING_SLOTS; slot++) {
+            if (slotPages[slot] == -1) {
+                return slot;
+            }
+        }
+        submitQueued(1);
+    }
+}
+
+void PMread(uint64_t physicalAddress, word_t* value) {
+    if (ram == nullptr) {
+        initializeSwap();
+    }
+    assert(physicalAddress < RAM_SIZE);
+    *value = ram[physicalAddress];
+}
+
+void PMwrite(uint64_t physicalAddress, word_t value) {
+    if (ram == nullptr) {
+        initializeSwap();
+    }
+    assert(physicalAddress < RAM_SIZE);
+    ram[physicalAddress] = value;
+}
+
+void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex) {
+    if (ram == nullptr) {
+        initializeSwap();
+    }
+    assert(frameIndex < NUM_FRAMES);
+    assert(evictedPageIndex < NUM_PAGES);
+    assert(swapSlots.count(evictedPageIndex) == 0);
+    // The frame's restore and an older write of the page must land before the write is issued
+    while (readSwapSlots.count(frameIndex) != 0 || findPageSlot(evictedPageIndex) != -1) {
+        submitQueued(1);
+    }
+    int slot = acquireSlot();
+    uint64_t swapSlot = takeSwapSlot();
+    char *slotAddress = staging + slot * slotBytes;
+    memcpy(slotAddress, ram + frameIndex * PAGE_SIZE, PAGE_BYTES);
+    queueRequest(IORING_OP_WRITE_FIXED, STAGING_BUFFER, slotAddress, swapSlot, (uint64_t)slot);
+    slotPages[slot] = (long long int)evictedPageIndex;
+    slotSwapSlots[slot] = swapSlot;
+    slotReleases[slot] = false;
+    swapSlots[evictedPageIndex] = swapSlot;
+    if (numQueued >= SWAP_SUBMIT_BATCH) {
+        submitQueued(0);
+    }
+}
+
+void PMqueueRestore(uint64_t frameIndex, uint64_t restoredPageIndex) {
+    if (ram == nullptr) {
+        initializeSwap();
+    }
+    assert(frameIndex < NUM_FRAMES);
+    assert(restoredPageIndex < NUM_PAGES);
+    assert(readSwapSlots.count(frameIndex) == 0);
+    std::unordered_map<uint64_t, uint64_t>::iterator swapEntry = swapSlots.find(restoredPageIndex);
+    if (swapEntry == swapSlots.end()) {
+        return;
+    }
+    uint64_t swapSlot = swapEntry->second;
+    swapSlots.erase(swapEntry);
+    word_t *frameAddress = ram + frameIndex * PAGE_SIZE;
+    int slot = findPageSlot(restoredPageIndex);
+    if (slot != -1) { // The write is still in flight, so the slot has the page
+        streamCopy(frameAddress, staging + slot * slotBytes, PAGE_BYTES);
+        slotReleases[slot] = true;
+        return;
+    }
+    // Completions are only reaped by submitQueued, so the reads in flight must fit the rings
+    while (readSwapSlots.size() >= SWAP_STAGING_SLOTS) {
+        submitQueued(1);
+    }
+    readSwapSlots[frameIndex] = swapSlot;
+    if (slotBytes == PAGE_BYTES) {
+        queueRequest(IORING_OP_READ_FIXED, RAM_BUFFER, frameAddress, swapSlot,
+                     READ_REQUEST | frameIndex);
+        submitQueued(0);
+        return;
+    }
+    queueRequest(IORING_OP_READ_FIXED, STAGING_BUFFER, staging + READ_SLOT * slotBytes, swapSlot,
+                 READ_REQUEST | frameIndex);
+    while (readSwapSlots.count(frameIndex) != 0) {
+        submitQueued(1);
+    }
+    streamCopy(frameAddress, staging + READ_SLOT * slotBytes, PAGE_BYTES);
+}
+
+void PMwaitRestores() {
+    while (!readSwapSlots.empty()) {
+        submitQueued(1);
+    }
+}
+
+void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex) {
+    PMqueueRestore(frameIndex, restoredPageIndex);
+    PMwaitRestores();
+}
+
+void PMprefetch(uint64_t physicalAddress) {
+    if (ram != nullptr) {
+        __builtin_prefetch(ram + physicalAddress);
+    }
+}
+
+void PMzeroFrame(uint64_t frameIndex) {
+    if (ram == nullptr) {
+        initializeSwap();
+    }
+    assert(frameIndex < NUM_FRAMES);
+    streamZero(ram + frameIndex * PAGE_SIZE, PAGE_BYTES);
+}
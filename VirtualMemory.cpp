@@ -1,21 +1,73 @@
 #include "VirtualMemory.h"
 #include "PhysicalMemory.h"
+#include "VirtualMemoryInternal.h"
+#include "VirtualMemoryExtensions.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#ifndef VICTIM_CACHE_SIZE
+#define VICTIM_CACHE_SIZE 8
+#endif
+#ifndef READAHEAD_ADAPT_INTERVAL
+#define READAHEAD_ADAPT_INTERVAL 32
+#endif
+#define ROW_WORDS ((PAGE_SIZE + 63) / 64)
+#ifndef BATCH_WALKS
+#define BATCH_WALKS 8
+#endif
+#define DECOMPOSE_CHUNK 16
+#ifndef BATCH_SORT_THRESHOLD
+#define BATCH_SORT_THRESHOLD 1024
+#endif
+#define RADIX_BITS 8
+#ifndef BATCH_RESTORE_GROUP
+#define BATCH_RESTORE_GROUP 16
+#endif
+#ifndef MAX_RANGES
+#define MAX_RANGES 16
+#endif
+// The page bitmaps are sparse above this many pages, where a dense one (about 1/8 byte per page,
+// cleared by every VMinitialize) would cost more than the pages the library can hold resident
+#ifndef DENSE_BITMAP_BITS
+#define DENSE_BITMAP_BITS (1LL << 20)
+#endif
+
+// A row holds the index of the frame it points to
+static_assert(NUM_FRAMES - 1 <= std::numeric_limits<word_t>::max(),
+              "the frame indices must fit in a word");
+
+void systemError(const char *message) {
+    std::cerr << "system error: " << message << ": " << strerror(errno) << std::endl;
+    exit(1);
+}
 
 /**
  * This function is responsible for emptying a given frame, i.e filling all the rows with 0's.
  * @param frameAddress The adress of the frame.
  */
 void emptyFrame(uint64_t frameAddress) {
+    if (PMzeroFrame != nullptr) {
+        PMzeroFrame(frameAddress / PAGE_SIZE);
+        return;
+    }
     for (int offset = 0; offset < PAGE_SIZE; offset++) {
         PMwrite(frameAddress + offset, 0);
     }
 }
 
-void VMinitialize() {
-    uint64_t rootFrameAddress = 0;
-    emptyFrame(rootFrameAddress);
-}
-
 /**
  * This function is responsible for extracting the offset from a memory address.
  * @param virtualAddress The virtual memory address.
@@ -54,168 +106,2123 @@ uint64_t concatenatePath(uint64_t currentPath, uint64_t currentOffset){
 //
 
 /**
- * This function is responsible for iterating over the table's tree using DFS and looking for a
- * suitable frame, according to the priorities specified in the exercise PDF.
- * @param virtualAddress The virtual address of the page.
- * @param level The level of the tree we are currently in.
- * @param currFrameOffset The current part of the address we want to translate.
- * @param frameIndex The index of the current frame.
- * @param maxFrameIndex The index of the max frame not in use.
- * @param pathToPage Path to potential page to evict.
- */
-void findFrame(uint64_t pageNumber, long long int parentAddress, int level,
-              std::size_t currFrameOffset, long long int frameIndex, long long int &maxFrameIndex,
-              int &maxCyclicalDistance, uint64_t &pageToEvict, uint64_t &parentOfPageToEvict,
-              uint64_t &frameToEvict, uint64_t pathToPage, uint64_t &forbiddenFrame,
-              word_t &currentFrameIndex, uint64_t addressToAdd, uint64_t &zeroFrameIndex) {
-    if(level < TABLES_DEPTH) {
-        word_t frameAddress = frameIndex * PAGE_SIZE;
-        bool allZeroFrames = true;
-        word_t value;
-        for (int i = 0; i < PAGE_SIZE; i++){
-            PMread(frameAddress + i, &value);
-            if (value != 0) {
-                allZeroFrames = false;
-                if (value > maxFrameIndex && value < NUM_FRAMES) {
-                    maxFrameIndex = value;
-                }
+ * A bitmap with summary levels above it: a bit in level l + 1 is set iff the matching word of
+ * level l is non-zero. Searching for the next or previous set bit skips whole empty words a level
+ * up, so it costs a few instructions per level instead of a scan of all the bits.
+ */
+template <long long int NumBits>
+struct SummaryBitmap {
+    static const int NUM_LEVELS = 4;
 
-                uint64_t updatedPathToPage = concatenatePath(pathToPage, i);
-
-                if (level == TABLES_DEPTH - 1) {
-                    // we extracted the page number of the page we may want to evict
-                    int cyclicDistance = (int)findCyclicDistance(pageNumber, updatedPathToPage);
-                    if (cyclicDistance > maxCyclicalDistance) {
-                        maxCyclicalDistance = cyclicDistance;
-                        pageToEvict = updatedPathToPage;
-                        parentOfPageToEvict = frameIndex;
-                        frameToEvict = value;
-                    }
-                }
+    static constexpr long long int numWords(int level) {
+        return level == 0 ? (NumBits + 63) / 64 : (numWords(level - 1) + 63) / 64;
+    }
+
+    static constexpr long long int levelOffset(int level) {
+        return level == 0 ? 0 : levelOffset(level - 1) + numWords(level - 1);
+    }
+
+    uint64_t words[levelOffset(NUM_LEVELS)];
+    long long int numSet;
+
+    void clearAll() {
+        for (long long int i = 0; i < levelOffset(NUM_LEVELS); i++) {
+            words[i] = 0;
+        }
+        numSet = 0;
+    }
+
+    bool test(long long int position) const {
+        return (words[position >> 6] >> (position & 63)) & 1;
+    }
+
+    void set(long long int position) {
+        if (test(position)) {
+            return;
+        }
+        numSet++;
+        for (int level = 0; level < NUM_LEVELS; level++) {
+            uint64_t &word = words[levelOffset(level) + (position >> 6)];
+            bool wasEmpty = word == 0;
+            word |= 1ULL << (position & 63);
+            if (!wasEmpty) {
+                return;
+            }
+            position >>= 6;
+        }
+    }
+
+    void clear(long long int position) {
+        if (!test(position)) {
+            return;
+        }
+        numSet--;
+        for (int level = 0; level < NUM_LEVELS; level++) {
+            uint64_t &word = words[levelOffset(level) + (position >> 6)];
+            word &= ~(1ULL << (position & 63));
+            if (word != 0) {
+                return;
+            }
+            position >>= 6;
+        }
+    }
 
-                findFrame(pageNumber, frameAddress + i, level + 1,
-                          currFrameOffset, value, maxFrameIndex, maxCyclicalDistance,
-                          pageToEvict, parentOfPageToEvict, frameToEvict, updatedPathToPage,
-                          forbiddenFrame, currentFrameIndex, addressToAdd, zeroFrameIndex);
-                if (maxFrameIndex == -1) { // A zero frame was found
-                    return;
+    /**
+     * @return The first set bit at or after position in the given level, -1 if there is none.
+     */
+    long long int findNext(long long int position, int level = 0) const {
+        long long int numBits = level == 0 ? NumBits : numWords(level - 1);
+        if (position >= numBits) {
+            return -1;
+        }
+        const uint64_t *bits = words + levelOffset(level);
+        long long int wordIndex = position >> 6;
+        uint64_t word = bits[wordIndex] & (~0ULL << (position & 63));
+        if (word == 0) {
+            if (level + 1 < NUM_LEVELS) {
+                wordIndex = findNext(wordIndex + 1, level + 1);
+            }
+            else {
+                do {
+                    wordIndex++;
+                } while (wordIndex < numWords(level) && bits[wordIndex] == 0);
+                if (wordIndex == numWords(level)) {
+                    wordIndex = -1;
                 }
             }
+            if (wordIndex == -1) {
+                return -1;
+            }
+            word = bits[wordIndex];
         }
-        // If the frames rows are all 0's, and it's the first empty frame we encounter
-        if (allZeroFrames && maxFrameIndex != -1 && (uint64_t)frameIndex != forbiddenFrame) {
-            currentFrameIndex = (word_t)frameIndex;
-            maxFrameIndex = -1;
-            zeroFrameIndex = frameIndex;
-            if (parentAddress != -1) { // if frame is not frame 0
-                PMwrite(parentAddress, 0);
+        return (wordIndex << 6) + __builtin_ctzll(word);
+    }
+
+    /**
+     * @return The last set bit at or before position in the given level, -1 if there is none.
+     */
+    long long int findPrevious(long long int position, int level = 0) const {
+        if (position < 0) {
+            return -1;
+        }
+        const uint64_t *bits = words + levelOffset(level);
+        long long int wordIndex = position >> 6;
+        uint64_t word = bits[wordIndex] & (~0ULL >> (63 - (position & 63)));
+        if (word == 0) {
+            if (level + 1 < NUM_LEVELS) {
+                wordIndex = findPrevious(wordIndex - 1, level + 1);
+            }
+            else {
+                do {
+                    wordIndex--;
+                } while (wordIndex >= 0 && bits[wordIndex] == 0);
             }
-            // Write to the relevant index and clear the table
-            PMwrite(addressToAdd, (word_t)frameIndex);
+            if (wordIndex == -1) {
+                return -1;
+            }
+            word = bits[wordIndex];
         }
+        return (wordIndex << 6) + 63 - __builtin_clzll(word);
     }
-}
+};
 
 /**
- * This function is responsible for adding the frame/page.
- * @param virtualAddress The virtual address of the page.
- * @param level The level of the tree we are currently in.
- * @param currFrameOffset The current part of the address we want to translate.
- * @param frameIndex The index of the current frame.
- * @param maxFrameIndex The index of the max frame not in use.
+ * A bitmap over a range too large to allocate, like the pages of a 48 or 57 bit virtual memory.
+ * Only its non-zero words are kept, ordered by position, so its memory scales with the bits set,
+ * and the next or previous set bit is one ordered lookup away.
  */
-void addFrame(uint64_t pageNumber, std::size_t currFrameOffset, int level, uint64_t &forbiddenFrame,
-              word_t &currentFrameIndex, uint64_t addressToAddTo) {
-    long long int maxFrameIndex = 0;
-    int maxCyclicalDistance = -1;
+struct SparseBitmap {
+    std::map<long long int, uint64_t> words;
+    long long int numSet;
+
+    void clearAll() {
+        words.clear();
+        numSet = 0;
+    }
 
-    // May cause problem if access not during the 3rd case
-    uint64_t pageToEvict = 0;
-    uint64_t parentOfPageToEvict = 0;
-    uint64_t frameToEvict = 0;
-    uint64_t zeroFrameIndex = -1;
+    bool test(long long int position) const {
+        std::map<long long int, uint64_t>::const_iterator word = words.find(position >> 6);
+        return word != words.end() && ((word->second >> (position & 63)) & 1);
+    }
 
-    findFrame(pageNumber, -1, 0, currFrameOffset,0, maxFrameIndex,
-              maxCyclicalDistance, pageToEvict, parentOfPageToEvict, frameToEvict, 0, forbiddenFrame,
-              currentFrameIndex, addressToAddTo, zeroFrameIndex);
-    // If the max index is -1, we already found an empty table, so return
-    if(maxFrameIndex == -1){
-        // empty frame
-        if (level == TABLES_DEPTH -1) {
-            PMrestore((uint64_t)zeroFrameIndex, pageNumber);
-            // What do we do if we restore a zero frame?
+    void set(long long int position) {
+        uint64_t &word = words[position >> 6];
+        if ((word >> (position & 63)) & 1) {
             return;
         }
+        word |= 1ULL << (position & 63);
+        numSet++;
+    }
 
-        else {
-            emptyFrame(zeroFrameIndex * PAGE_SIZE);
-            forbiddenFrame = zeroFrameIndex;
+    void clear(long long int position) {
+        std::map<long long int, uint64_t>::iterator word = words.find(position >> 6);
+        if (word == words.end() || !((word->second >> (position & 63)) & 1)) {
+            return;
         }
-    }
-    // If there is a free frame
-    else if (maxFrameIndex + 1 < NUM_FRAMES){
-        currentFrameIndex = maxFrameIndex + 1;
-        PMwrite(addressToAddTo, maxFrameIndex + 1);
-        if(level == TABLES_DEPTH - 1){
-            PMrestore(maxFrameIndex + 1, pageNumber);
+        numSet--;
+        word->second &= ~(1ULL << (position & 63));
+        if (word->second == 0) {
+            words.erase(word);
         }
-        else {
-            emptyFrame((maxFrameIndex + 1) * PAGE_SIZE);
-            forbiddenFrame = maxFrameIndex + 1;
+    }
+
+    /**
+     * @return The first set bit at or after position, -1 if there is none.
+     */
+    long long int findNext(long long int position) const {
+        std::map<long long int, uint64_t>::const_iterator word = words.lower_bound(position >> 6);
+        if (word != words.end() && word->first == position >> 6) {
+            uint64_t bits = word->second & (~0ULL << (position & 63));
+            if (bits != 0) {
+                return (word->first << 6) + __builtin_ctzll(bits);
+            }
+            ++word;
         }
+        return word == words.end() ? -1 : (word->first << 6) + __builtin_ctzll(word->second);
     }
-    else { // There are no more unused frames
-        currentFrameIndex = (word_t) frameToEvict;
-        PMevict(frameToEvict, pageToEvict);
-        PMwrite(parentOfPageToEvict * PAGE_SIZE + getOffset(pageToEvict), 0);
-        PMwrite(addressToAddTo, (word_t )frameToEvict);
-        if(level == TABLES_DEPTH - 1){
-            PMrestore(frameToEvict, pageNumber);
+
+    /**
+     * @return The last set bit at or before position, -1 if there is none.
+     */
+    long long int findPrevious(long long int position) const {
+        if (position < 0) {
+            return -1;
         }
-        else{
-            emptyFrame(frameToEvict * PAGE_SIZE);
-            forbiddenFrame = frameToEvict;
+        std::map<long long int, uint64_t>::const_iterator word = words.upper_bound(position >> 6);
+        if (word == words.begin()) {
+            return -1;
+        }
+        --word;
+        if (word->first == position >> 6) {
+            uint64_t bits = word->second & (~0ULL >> (63 - (position & 63)));
+            if (bits != 0) {
+                return (word->first << 6) + 63 - __builtin_clzll(bits);
+            }
+            if (word == words.begin()) {
+                return -1;
+            }
+            --word;
         }
+        return (word->first << 6) + 63 - __builtin_clzll(word->second);
+    }
+};
+
+// The page bitmaps, dense only for small virtual memories so their memory follows the resident set
+typedef std::conditional<NUM_PAGES <= DENSE_BITMAP_BITS, SummaryBitmap<NUM_PAGES>,
+                         SparseBitmap>::type PageBitmap;
+
+/**
+ * What the tree says about a frame. It is kept up to date on every link and unlink, so the fault
+ * path does not need to scan the tree to learn it.
+ */
+struct FrameEntry {
+    long long int parentAddress; // The row pointing to the frame, -1 for frame 0 and unused frames
+    int level;                   // The level of a table, TABLES_DEPTH for a page
+    uint64_t path;               // The path to a table, the page number of a page
+    int numChildren;             // The number of non-zero rows of a table (of resident pages, for
+                                 // a leaf table of the clustered layout)
+};
+
+/**
+ * A page which may be evicted, with the table row pointing to it.
+ */
+struct PageCandidate {
+    uint64_t pageNumber;
+    uint64_t frameIndex;
+    uint64_t parentFrameIndex;
+    long long int cyclicDistance;
+};
+
+/**
+ * The best eviction candidates with respect to referencePage, best first. Every resident page
+ * outside the cache is at most bound away from referencePage, so by the triangle inequality the
+ * best cached page for another page p is the best overall if it is more than
+ * bound + distance(p, referencePage) away from p.
+ */
+struct VictimCache {
+    uint64_t referencePage;
+    long long int bound;
+    int numCandidates;
+    PageCandidate candidates[VICTIM_CACHE_SIZE];
+};
+
+/**
+ * A run of consecutive resident pages held by consecutive frames.
+ */
+struct RangeEntry {
+    uint64_t firstPage;
+    uint64_t firstFrame;
+    uint64_t length;
+};
+
+/**
+ * The empty tables the missing levels of a walk (at most TABLES_DEPTH of them) may take: the first
+ * ones in DFS order excluding pinned frames, and the tables emptied later.
+ */
+struct FrameCandidates {
+    int numEmptyTables;
+    uint64_t emptyTables[2 * TABLES_DEPTH];
+
+    FrameCandidates() : numEmptyTables(0) {}
+};
+
+static std::vector<FrameEntry> frameEntries(NUM_FRAMES);
+static long long int numEmptyTables = 0;
+// The frames at or above the limit are neither free nor used
+static long long int usableFrames = NUM_FRAMES;
+// The frames no row points to, the frames holding tables, and the frames which must not be taken
+static SummaryBitmap<NUM_FRAMES> freeFrames;
+static SummaryBitmap<NUM_FRAMES> tableFrames;
+static SummaryBitmap<NUM_FRAMES> pinnedFrames;
+// Set while native access mirrors the virtual memory in a host region
+static word_t *nativeRegion = nullptr;
+static EvictionHook evictionHook = nullptr;
+static VictimCache victimCache;
+// The resident pages by ring position, to find the ones farthest from a page
+static PageBitmap residentPages;
+// Swap-in readahead: the pages in swap, the pages restored speculatively and not accessed since,
+// and the accounting which adapts the window
+static PageBitmap swappedPages;
+static PageBitmap prefetchedPages;
+static int readaheadMaxWindow = 0;
+static int readaheadWindow = 0;
+static long long int readaheadHits = 0;
+static long long int readaheadWaste = 0;
+static int intervalHits = 0;
+static int intervalWaste = 0;
+// While set, the faults leave their restores in flight for the caller to finish
+static bool batchingRestores = false;
+// The level of the tables evicted along with their subtree instead of a victim page, 0 for none
+static int tableEvictionLevel = 0;
+// Background zeroing: the free frames zeroed and not zeroed yet, and the frame being zeroed (-1 for
+// none). While the thread runs, the free frames only change under zeroingMutex.
+static std::thread zeroingThread;
+static std::mutex zeroingMutex;
+static std::condition_variable zeroingCondition;
+static SummaryBitmap<NUM_FRAMES> zeroedFrames;
+static SummaryBitmap<NUM_FRAMES> unzeroedFreeFrames;
+static long long int zeroingFrame = -1;
+static long long int zeroedPoolSize = 0;
+static bool stopZeroing = false;
+// Lazy zeroing: a table's rows count as 0 unless written since the frame's generation last changed,
+// as recorded by its written rows bitmap (valid only if stamped with the frame's generation)
+static bool lazyZeroing = false;
+static bool lazyZeroingRequested = false;
+// (allocated when first used, with ROW_WORDS words of written rows per frame)
+static std::vector<uint64_t> frameGenerations;
+static std::vector<uint64_t> writtenRowsGenerations;
+static std::vector<uint64_t> writtenRows;
+// Path compression: tables other than the root have at least two children, and a row points
+// straight to the next table with more than one child (or to the page), skipping the levels between
+static bool pathCompression = false;
+static bool pathCompressionRequested = false;
+// Range translation: runs of at least two pages, translated without a walk, and the last one hit
+static bool rangeTranslation = false;
+static int numRanges = 0;
+static RangeEntry ranges[MAX_RANGES];
+static int lastRange = 0;
+// The clustered layout: a leaf row maps an aligned cluster of this many pages (its log2 below), so
+// the walks are keyed by cluster number, the page number without its low clusterShift bits
+static int clusterSize = 1;
+static int clusterShift = 0;
+static int clusterSizeRequested = 1;
+
+/**
+ * This function extracts the row a page's walk reads from the table in a given level.
+ * @param pageNumber The page number.
+ * @param level The level of the table.
+ * @return The row in the table of that level.
+ */
+uint64_t getTableOffset(uint64_t pageNumber, int level){
+    std::size_t numBitsToShift = (TABLES_DEPTH - 1 - (std::size_t)level) * OFFSET_WIDTH +
+                                 (std::size_t)clusterShift;
+    return (pageNumber >> numBitsToShift) & ((1LL << OFFSET_WIDTH) - 1);
+}
+
+/**
+ * This function computes the path to the table of a given level on a page's path.
+ * @param pageNumber The page number.
+ * @param level The level of the table.
+ * @return The table's path.
+ */
+uint64_t getTablePath(uint64_t pageNumber, int level) {
+    return pageNumber >> ((TABLES_DEPTH - (std::size_t)level) * OFFSET_WIDTH +
+                          (std::size_t)clusterShift);
+}
+
+/**
+ * This function finds the frame of the first page a leaf row maps. A leaf row of the clustered
+ * layout holds that frame, plus clusterSize so it stays positive, above a mask of the cluster's
+ * resident pages, each held by the frame at its slot from the first one. Otherwise a leaf row is
+ * the frame of its one page.
+ * @param row The row.
+ * @return The frame of the row's first page.
+ */
+long long int getClusterBase(word_t row) {
+    if (clusterSize == 1) {
+        return row;
     }
+    return (long long int)((uint64_t)row >> clusterSize) - clusterSize;
 }
 
-uint64_t translateVirtualAddress(uint64_t virtualAddress){
-    // Find first offset lsb bits which are ones
-    int bitsToExtract = ((1 << OFFSET_WIDTH) - 1);
-    uint64_t pageNumber = virtualAddress >> OFFSET_WIDTH;
-    word_t frameIndex = 0; // initialize frame address to point to frame 0
-    uint64_t forbiddenFrame = 0;
-    for (int level = 0; level < TABLES_DEPTH; level++) {
-        // The offset of the frame in level
-        std::size_t numBitsToShift = (TABLES_DEPTH - (std::size_t)level) * OFFSET_WIDTH;
-        uint64_t currFrameOffset = virtualAddress >> numBitsToShift;
-        currFrameOffset = currFrameOffset & bitsToExtract;
-        uint64_t addressToAddTo = frameIndex * PAGE_SIZE + currFrameOffset;
-        PMread(frameIndex * PAGE_SIZE + currFrameOffset, &frameIndex);
-        if (frameIndex == 0) { // There is no child frame
-            addFrame(pageNumber, currFrameOffset, level, forbiddenFrame, frameIndex, addressToAddTo);
-        }
+/**
+ * This function finds the slots of the resident pages a leaf row maps.
+ * @param row The row.
+ * @return The mask of the slots.
+ */
+uint64_t getClusterMask(word_t row) {
+    if (clusterSize == 1) {
+        return row != 0;
     }
-    uint64_t pageOffset = getOffset(virtualAddress);
-    return (frameIndex * PAGE_SIZE) + pageOffset;
+    return (uint64_t)row & ((1ULL << clusterSize) - 1);
 }
 
-int VMread(uint64_t virtualAddress, word_t* value) {
-    if(!value || virtualAddress >= VIRTUAL_MEMORY_SIZE){
+/**
+ * This function builds a leaf row of the clustered layout.
+ * @param baseFrameIndex The frame of the cluster's first page.
+ * @param mask The slots of the cluster's resident pages.
+ * @return The row, 0 if no page is resident.
+ */
+word_t makeClusterRow(long long int baseFrameIndex, uint64_t mask) {
+    if (mask == 0) {
         return 0;
     }
+    return (word_t)(((uint64_t)(baseFrameIndex + clusterSize) << clusterSize) | mask);
+}
 
-    uint64_t physicalAddress = translateVirtualAddress(virtualAddress);
-    PMread(physicalAddress, value);
-    return 1;
+/**
+ * This function finds the slot of a page in its cluster.
+ * @param pageNumber The page.
+ * @return The slot.
+ */
+long long int getClusterSlot(uint64_t pageNumber) {
+    return (long long int)(pageNumber & (uint64_t)(clusterSize - 1));
 }
 
-int VMwrite(uint64_t virtualAddress, word_t value){
-    if(virtualAddress >= VIRTUAL_MEMORY_SIZE){
+/**
+ * This function finds the frame a leaf row gives a page.
+ * @param row The row.
+ * @param pageNumber The page.
+ * @return The frame, 0 if the page is not resident.
+ */
+word_t getPageFrame(word_t row, uint64_t pageNumber) {
+    long long int slot = getClusterSlot(pageNumber);
+    if (((getClusterMask(row) >> slot) & 1) == 0) {
         return 0;
     }
+    return (word_t)(getClusterBase(row) + slot);
+}
 
-    uint64_t physicalAddress = translateVirtualAddress(virtualAddress);
-    PMwrite(physicalAddress, value);
+/**
+ * This function tells whether a table row was written in the frame's current generation.
+ * @param frameIndex The table.
+ * @param row The row.
+ * @return true if it was.
+ */
+bool isRowWritten(uint64_t frameIndex, int row) {
+    return writtenRowsGenerations[frameIndex] == frameGenerations[frameIndex] &&
+           ((writtenRows[frameIndex * ROW_WORDS + (row >> 6)] >> (row & 63)) & 1);
+}
+
+/**
+ * This function finds the next row of a table which may be non-zero. With lazy zeroing only the
+ * rows written in the frame's current generation can be, so a word of unwritten rows is skipped at
+ * once, and a table stamped with an older generation has none at all.
+ * @param frameIndex The table.
+ * @param row The first row to consider.
+ * @return The row, PAGE_SIZE if there is none.
+ */
+int nextTableRow(uint64_t frameIndex, int row) {
+    if (!lazyZeroing || row >= PAGE_SIZE) {
+        return row;
+    }
+    if (writtenRowsGenerations[frameIndex] != frameGenerations[frameIndex]) {
+        return PAGE_SIZE;
+    }
+    const uint64_t *words = &writtenRows[frameIndex * ROW_WORDS];
+    int word = row >> 6;
+    uint64_t bits = words[word] & (~0ULL << (row & 63));
+    while (bits == 0) {
+        if (++word == ROW_WORDS) {
+            return PAGE_SIZE;
+        }
+        bits = words[word];
+    }
+    return (word << 6) + __builtin_ctzll(bits);
+}
+
+/**
+ * This function reads a table row.
+ * @param rowAddress The row's address.
+ * @param value The row.
+ */
+void readRow(uint64_t rowAddress, word_t *value) {
+    if (lazyZeroing && !isRowWritten(rowAddress / PAGE_SIZE, (int)(rowAddress % PAGE_SIZE))) {
+        *value = 0;
+        return;
+    }
+    PMread(rowAddress, value);
+}
+
+/**
+ * This function writes a table row. With lazy zeroing, writing 0 only marks the row unwritten.
+ * @param rowAddress The row's address.
+ * @param value The row.
+ */
+void writeRow(uint64_t rowAddress, word_t value) {
+    if (!lazyZeroing) {
+        PMwrite(rowAddress, value);
+        return;
+    }
+    uint64_t frameIndex = rowAddress / PAGE_SIZE;
+    int row = (int)(rowAddress % PAGE_SIZE);
+    if (writtenRowsGenerations[frameIndex] != frameGenerations[frameIndex]) {
+        for (int word = 0; word < ROW_WORDS; word++) {
+            writtenRows[frameIndex * ROW_WORDS + word] = 0;
+        }
+        writtenRowsGenerations[frameIndex] = frameGenerations[frameIndex];
+    }
+    if (value == 0) {
+        writtenRows[frameIndex * ROW_WORDS + (row >> 6)] &= ~(1ULL << (row & 63));
+        return;
+    }
+    writtenRows[frameIndex * ROW_WORDS + (row >> 6)] |= 1ULL << (row & 63);
+    PMwrite(rowAddress, value);
+}
+
+/**
+ * This function makes a frame an empty table, in O(1) with lazy zeroing.
+ * @param frameIndex The frame.
+ */
+void resetTable(uint64_t frameIndex) {
+    if (lazyZeroing) {
+        frameGenerations[frameIndex]++;
+        return;
+    }
+    emptyFrame(frameIndex * PAGE_SIZE);
+}
+
+void VMsetLazyZeroing(int enable) {
+    lazyZeroingRequested = enable != 0;
+}
+
+void VMsetPathCompression(int enable) {
+    pathCompressionRequested = enable != 0;
+}
+
+int VMsetClusterSize(int numPages) {
+    // A leaf row must hold the frame of the cluster's first page above a bit per page
+    if (numPages < 1 || numPages >= 64 || (numPages & (numPages - 1)) != 0 ||
+        (uint64_t)NUM_FRAMES + (uint64_t)numPages >
+        (uint64_t)std::numeric_limits<word_t>::max() >> numPages) {
+        return 0;
+    }
+    clusterSizeRequested = numPages;
+    return 1;
+}
+
+void VMsetRangeTranslation(int enable) {
+    rangeTranslation = enable != 0;
+    numRanges = 0;
+}
+
+void VMinitialize() {
+    // The zeroing thread must not be writing a frame which becomes the root or loses its zeroes
+    std::unique_lock<std::mutex> lock(zeroingMutex, std::defer_lock);
+    if (zeroingThread.joinable()) {
+        lock.lock();
+        zeroingCondition.wait(lock, [] { return zeroingFrame == -1; });
+    }
+    lazyZeroing = lazyZeroingRequested;
+    pathCompression = pathCompressionRequested;
+    clusterSize = pathCompression ? 1 : clusterSizeRequested;
+    clusterShift = __builtin_ctz((unsigned int)clusterSize);
+    if (lazyZeroing && frameGenerations.empty()) {
+        frameGenerations.assign(NUM_FRAMES, 0);
+        writtenRowsGenerations.assign(NUM_FRAMES, 0);
+        writtenRows.assign(NUM_FRAMES * ROW_WORDS, 0);
+    }
+    resetTable(0);
+    for (long long int frameIndex = 0; frameIndex < NUM_FRAMES; frameIndex++) {
+        frameEntries[frameIndex].parentAddress = -1;
+        frameEntries[frameIndex].level = 0;
+        frameEntries[frameIndex].path = 0;
+        frameEntries[frameIndex].numChildren = 0;
+    }
+    numEmptyTables = 1; // Frame 0 is an empty table
+    freeFrames.clearAll();
+    for (long long int frameIndex = 1; frameIndex < usableFrames; frameIndex++) {
+        freeFrames.set(frameIndex);
+    }
+    zeroedFrames.clearAll();
+    unzeroedFreeFrames = freeFrames;
+    tableFrames.clearAll();
+    tableFrames.set(0);
+    pinnedFrames.clearAll();
+    residentPages.clearAll();
+    numRanges = 0;
+    victimCache.referencePage = 0;
+    victimCache.bound = -1;
+    victimCache.numCandidates = 0;
+    swappedPages.clearAll();
+    prefetchedPages.clearAll();
+    readaheadWindow = readaheadMaxWindow;
+    readaheadHits = 0;
+    readaheadWaste = 0;
+    intervalHits = 0;
+    intervalWaste = 0;
+    resetPressure();
+}
+
+/**
+ * This function is the zeroing thread: it zeroes the free frames, lowest first since those are
+ * taken first, as long as fewer than the pool size are zeroed.
+ */
+void zeroFrames() {
+    std::unique_lock<std::mutex> lock(zeroingMutex);
+    while (true) {
+        zeroingCondition.wait(lock, [] {
+            return stopZeroing ||
+                   (unzeroedFreeFrames.numSet > 0 && zeroedFrames.numSet < zeroedPoolSize);
+        });
+        if (stopZeroing) {
+            return;
+        }
+        long long int frameIndex = unzeroedFreeFrames.findNext(0);
+        unzeroedFreeFrames.clear(frameIndex);
+        zeroingFrame = frameIndex;
+        lock.unlock();
+        emptyFrame((uint64_t)frameIndex * PAGE_SIZE);
+        lock.lock();
+        zeroingFrame = -1;
+        zeroedFrames.set(frameIndex);
+        zeroingCondition.notify_all();
+    }
+}
+
+int VMstartZeroing(long long int poolSize) {
+    if (poolSize <= 0 || zeroingThread.joinable()) {
+        return 0;
+    }
+    zeroedFrames.clearAll();
+    unzeroedFreeFrames = freeFrames;
+    zeroingFrame = -1;
+    zeroedPoolSize = poolSize;
+    stopZeroing = false;
+    // The physical memory may set itself up on first access, which must not race with the thread
+    word_t value;
+    PMread(0, &value);
+    // Registered after the statics the thread uses (ours and the physical memory's) are built, so
+    // it runs before they are destroyed
+    static bool stopRegistered = false;
+    if (!stopRegistered) {
+        atexit(VMstopZeroing);
+        stopRegistered = true;
+    }
+    zeroingThread = std::thread(zeroFrames);
     return 1;
-}
\ No newline at end of file
+}
+
+void VMstopZeroing() {
+    if (!zeroingThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(zeroingMutex);
+        stopZeroing = true;
+    }
+    zeroingCondition.notify_all();
+    zeroingThread.join();
+}
+
+/**
+ * This function records a frame as free.
+ * @param frameIndex The frame.
+ */
+void markFrameFree(long long int frameIndex) {
+    if (!zeroingThread.joinable()) {
+        freeFrames.set(frameIndex);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(zeroingMutex);
+    freeFrames.set(frameIndex);
+    unzeroedFreeFrames.set(frameIndex);
+    zeroingCondition.notify_all();
+}
+
+/**
+ * This function records a frame as no longer free, waiting for the zeroing thread if it is
+ * zeroing it.
+ * @param frameIndex The frame.
+ * @return true if the zeroing thread zeroed it.
+ */
+bool markFrameUsed(long long int frameIndex) {
+    if (!zeroingThread.joinable()) {
+        freeFrames.clear(frameIndex);
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(zeroingMutex);
+    zeroingCondition.wait(lock, [frameIndex] { return zeroingFrame != frameIndex; });
+    freeFrames.clear(frameIndex);
+    unzeroedFreeFrames.clear(frameIndex);
+    bool zeroed = zeroedFrames.test(frameIndex);
+    zeroedFrames.clear(frameIndex);
+    zeroingCondition.notify_all();
+    return zeroed;
+}
+
+void VMsetReadahead(int maxWindow) {
+    if (maxWindow < 0) {
+        maxWindow = 0;
+    }
+    if (maxWindow > PAGE_SIZE - 1) {
+        maxWindow = PAGE_SIZE - 1;
+    }
+    readaheadMaxWindow = maxWindow;
+    readaheadWindow = maxWindow;
+}
+
+void VMsetTableEviction(int level) {
+    if (level < 0 || level >= TABLES_DEPTH) {
+        level = 0;
+    }
+    tableEvictionLevel = level;
+}
+
+void VMgetReadaheadStats(long long int *hits, long long int *waste, int *window) {
+    *hits = readaheadHits;
+    *waste = readaheadWaste;
+    *window = readaheadWindow;
+}
+
+/**
+ * This function accounts for a prefetched page which was accessed or evicted, and every
+ * READAHEAD_ADAPT_INTERVAL such pages doubles the window if most were accessed, or halves it if
+ * most were wasted.
+ * @param hit true if the page was accessed.
+ */
+void recordReadahead(bool hit) {
+    if (hit) {
+        readaheadHits++;
+        intervalHits++;
+    }
+    else {
+        readaheadWaste++;
+        intervalWaste++;
+    }
+    if (intervalHits + intervalWaste < READAHEAD_ADAPT_INTERVAL) {
+        return;
+    }
+    if (intervalHits > intervalWaste) {
+        readaheadWindow = 2 * readaheadWindow < readaheadMaxWindow ? 2 * readaheadWindow :
+                          readaheadMaxWindow;
+    }
+    else if (intervalWaste > intervalHits && readaheadWindow > 1) {
+        readaheadWindow /= 2;
+    }
+    intervalHits = 0;
+    intervalWaste = 0;
+}
+
+/**
+ * This function compares eviction candidates by the exercise's rule: the larger cyclic distance
+ * wins, and on a tie the page the DFS meets first, i.e the smaller page number.
+ * @param page The first page.
+ * @param otherPage The second page, with its distance from the same page.
+ * @return true if page should be evicted before otherPage.
+ */
+bool isBetterVictim(const PageCandidate &page, const PageCandidate &otherPage) {
+    if (page.cyclicDistance != otherPage.cyclicDistance) {
+        return page.cyclicDistance > otherPage.cyclicDistance;
+    }
+    return page.pageNumber < otherPage.pageNumber;
+}
+
+/**
+ * This function inserts a page into the victim cache if it may be better than the pages left out
+ * of it. When the cache is full its worst page is dropped, and the bound grows to cover it.
+ * @param page The page, with its distance from the cache's reference page.
+ */
+void insertCachedVictim(const PageCandidate &page) {
+    if (page.cyclicDistance <= victimCache.bound) {
+        return;
+    }
+    int position = victimCache.numCandidates;
+    while (position > 0 && isBetterVictim(page, victimCache.candidates[position - 1])) {
+        position--;
+    }
+    if (victimCache.numCandidates == VICTIM_CACHE_SIZE) {
+        const PageCandidate &dropped = position == VICTIM_CACHE_SIZE ? page :
+                                       victimCache.candidates[VICTIM_CACHE_SIZE - 1];
+        if (dropped.cyclicDistance > victimCache.bound) {
+            victimCache.bound = dropped.cyclicDistance;
+        }
+        if (position == VICTIM_CACHE_SIZE) {
+            return;
+        }
+        victimCache.numCandidates--;
+    }
+    for (int i = victimCache.numCandidates; i > position; i--) {
+        victimCache.candidates[i] = victimCache.candidates[i - 1];
+    }
+    victimCache.candidates[position] = page;
+    victimCache.numCandidates++;
+}
+
+/**
+ * This function removes a page which is no longer resident from the victim cache.
+ * @param pageNumber The page number.
+ */
+void removeCachedVictim(uint64_t pageNumber) {
+    for (int i = 0; i < victimCache.numCandidates; i++) {
+        if (victimCache.candidates[i].pageNumber == pageNumber) {
+            for (int j = i + 1; j < victimCache.numCandidates; j++) {
+                victimCache.candidates[j - 1] = victimCache.candidates[j];
+            }
+            victimCache.numCandidates--;
+            return;
+        }
+    }
+}
+
+/**
+ * This function tells whether a frame is on the path to a page: a table whose path is a prefix of
+ * the page number, or the page itself.
+ * @param frameIndex The frame.
+ * @param pageNumber The page number.
+ * @return true if it is.
+ */
+bool isOnPath(uint64_t frameIndex, uint64_t pageNumber) {
+    const FrameEntry &entry = frameEntries[frameIndex];
+    return entry.path == pageNumber >> ((TABLES_DEPTH - (std::size_t)entry.level) * OFFSET_WIDTH);
+}
+
+/**
+ * This function walks the path compressed tree toward a page, following rows as long as they point
+ * to tables on the page's path.
+ * @param pageNumber The page number.
+ * @param rowAddress The address of the last row read.
+ * @param child That row: the page's frame, 0, or a frame off the page's path.
+ */
+void walkCompressed(uint64_t pageNumber, uint64_t &rowAddress, word_t &child) {
+    uint64_t tableIndex = 0;
+    int level = 0;
+    while (true) {
+        rowAddress = tableIndex * PAGE_SIZE + getTableOffset(pageNumber, level);
+        readRow(rowAddress, &child);
+        if (child == 0 || !isOnPath((uint64_t)child, pageNumber) ||
+            frameEntries[child].level == TABLES_DEPTH) {
+            return;
+        }
+        tableIndex = (uint64_t)child;
+        level = frameEntries[child].level;
+    }
+}
+
+/**
+ * This function walks the tree to the frame of a resident page.
+ * @param pageNumber The page number.
+ * @param page The page's frame and the table pointing to it.
+ */
+void findPageFrame(uint64_t pageNumber, PageCandidate &page) {
+    word_t frameIndex = 0;
+    if (pathCompression) {
+        uint64_t rowAddress;
+        walkCompressed(pageNumber, rowAddress, frameIndex);
+        page.parentFrameIndex = rowAddress / PAGE_SIZE;
+        page.pageNumber = pageNumber;
+        page.frameIndex = (uint64_t)frameIndex;
+        return;
+    }
+    for (int level = 0; level < TABLES_DEPTH; level++) {
+        page.parentFrameIndex = (uint64_t)frameIndex;
+        readRow(frameIndex * PAGE_SIZE + getTableOffset(pageNumber, level), &frameIndex);
+    }
+    if (clusterSize > 1) {
+        frameIndex = getPageFrame(frameIndex, pageNumber);
+    }
+    page.pageNumber = pageNumber;
+    page.frameIndex = (uint64_t)frameIndex;
+}
+
+/**
+ * This function refills the victim cache with the best pages for a new reference page. The pages
+ * farthest from it are the ones closest to its antipode, so they are collected by walking the
+ * resident pages bitmap outwards from the antipode in both directions.
+ * @param pageNumber The new reference page.
+ */
+void refreshVictimCache(uint64_t pageNumber) {
+    victimCache.referencePage = pageNumber;
+    victimCache.bound = -1;
+    victimCache.numCandidates = 0;
+    long long int numPages = residentPages.numSet;
+    if (numPages == 0) {
+        return;
+    }
+    long long int antipode = (long long int)((pageNumber + NUM_PAGES / 2) % NUM_PAGES);
+    long long int forward = residentPages.findNext(antipode);
+    if (forward == -1) {
+        forward = residentPages.findNext(0);
+    }
+    long long int backward = residentPages.findPrevious(antipode - 1);
+    if (backward == -1) {
+        backward = residentPages.findPrevious(NUM_PAGES - 1);
+    }
+    while (victimCache.numCandidates < VICTIM_CACHE_SIZE && victimCache.numCandidates < numPages) {
+        long long int forwardDistance = (forward - antipode + NUM_PAGES) % NUM_PAGES;
+        long long int backwardDistance = (antipode - backward + NUM_PAGES) % NUM_PAGES;
+        bool takeForward = forwardDistance < backwardDistance ||
+                           (forwardDistance == backwardDistance && forward < backward);
+        PageCandidate &page = victimCache.candidates[victimCache.numCandidates++];
+        findPageFrame((uint64_t)(takeForward ? forward : backward), page);
+        page.cyclicDistance = (long long int)findCyclicDistance(pageNumber, page.pageNumber);
+        victimCache.bound = page.cyclicDistance;
+        if (takeForward) {
+            forward = residentPages.findNext(forward + 1);
+            if (forward == -1) {
+                forward = residentPages.findNext(0);
+            }
+        }
+        else {
+            backward = residentPages.findPrevious(backward - 1);
+            if (backward == -1) {
+                backward = residentPages.findPrevious(NUM_PAGES - 1);
+            }
+        }
+    }
+    if (victimCache.numCandidates == numPages) { // No page was left out
+        victimCache.bound = -1;
+    }
+}
+
+/**
+ * This function finds the page to evict for a page we swap in using the victim cache, refreshing
+ * it only when it drained or cannot prove its best page is the best overall.
+ * @param pageNumber The page we want to swap in.
+ * @return The page to evict.
+ */
+PageCandidate takeCachedVictim(uint64_t pageNumber) {
+    if (victimCache.numCandidates > 0) {
+        long long int referenceDistance = (long long int)findCyclicDistance(
+                pageNumber, victimCache.referencePage);
+        int best = -1;
+        PageCandidate bestPage;
+        for (int i = 0; i < victimCache.numCandidates; i++) {
+            PageCandidate page = victimCache.candidates[i];
+            page.cyclicDistance = (long long int)findCyclicDistance(pageNumber, page.pageNumber);
+            if (best == -1 || isBetterVictim(page, bestPage)) {
+                best = i;
+                bestPage = page;
+            }
+        }
+        if (bestPage.cyclicDistance > victimCache.bound + referenceDistance) {
+            return bestPage;
+        }
+    }
+    refreshVictimCache(pageNumber);
+    return victimCache.candidates[0];
+}
+
+/**
+ * This function tells whether a frame holds a page.
+ * @param frameIndex The frame.
+ * @param pageNumber The page.
+ * @return true if it does.
+ */
+bool holdsPage(uint64_t frameIndex, uint64_t pageNumber) {
+    if (frameIndex >= NUM_FRAMES) {
+        return false;
+    }
+    const FrameEntry &entry = frameEntries[frameIndex];
+    return entry.parentAddress != -1 && entry.level == TABLES_DEPTH && entry.path == pageNumber;
+}
+
+/**
+ * This function finds the range holding a page, trying the last one hit first.
+ * @param pageNumber The page.
+ * @return The range's index, -1 if none holds it.
+ */
+int findRange(uint64_t pageNumber) {
+    if (lastRange < numRanges && pageNumber - ranges[lastRange].firstPage <
+                                 ranges[lastRange].length) {
+        return lastRange;
+    }
+    for (int range = 0; range < numRanges; range++) {
+        if (pageNumber - ranges[range].firstPage < ranges[range].length) {
+            lastRange = range;
+            return range;
+        }
+    }
+    return -1;
+}
+
+/**
+ * This function adds a range, in place of the shortest one if all are taken and it is shorter.
+ * @param firstPage The range's first page.
+ * @param firstFrame The frame of its first page.
+ * @param length The number of pages in it.
+ * @return The range's index, -1 if it was not added.
+ */
+int addRange(uint64_t firstPage, uint64_t firstFrame, uint64_t length) {
+    int range = numRanges;
+    if (numRanges == MAX_RANGES) {
+        range = 0;
+        for (int i = 1; i < numRanges; i++) {
+            if (ranges[i].length < ranges[range].length) {
+                range = i;
+            }
+        }
+        if (ranges[range].length >= length) {
+            return -1;
+        }
+    }
+    else {
+        numRanges++;
+    }
+    ranges[range].firstPage = firstPage;
+    ranges[range].firstFrame = firstFrame;
+    ranges[range].length = length;
+    return range;
+}
+
+/**
+ * This function removes a range.
+ * @param range The range's index.
+ */
+void removeRange(int range) {
+    ranges[range] = ranges[--numRanges];
+}
+
+/**
+ * This function records a page just linked in the ranges: it extends the range ending right before
+ * it and the one starting right after it (merging the two), or starts a range with a neighbouring
+ * page whose frame is next to its own.
+ * @param pageNumber The page.
+ * @param frameIndex The page's frame.
+ */
+void addRangePage(uint64_t pageNumber, uint64_t frameIndex) {
+    int range = -1;
+    // The page was not resident, so a range holding the page before it ends there
+    if (pageNumber > 0 && holdsPage(frameIndex - 1, pageNumber - 1)) {
+        range = findRange(pageNumber - 1);
+        if (range != -1) {
+            ranges[range].length++;
+        }
+        else {
+            range = addRange(pageNumber - 1, frameIndex - 1, 2);
+        }
+    }
+    if (pageNumber + 1 < NUM_PAGES && holdsPage(frameIndex + 1, pageNumber + 1)) {
+        int nextRange = findRange(pageNumber + 1);
+        if (range != -1 && nextRange != -1) {
+            ranges[range].length += ranges[nextRange].length;
+            removeRange(nextRange);
+        }
+        else if (range != -1) {
+            ranges[range].length++;
+        }
+        else if (nextRange != -1) {
+            ranges[nextRange].firstPage--;
+            ranges[nextRange].firstFrame--;
+            ranges[nextRange].length++;
+        }
+        else {
+            addRange(pageNumber, frameIndex, 2);
+        }
+    }
+}
+
+/**
+ * This function drops a page about to be unlinked from its range, splitting the range in two. The
+ * parts shorter than two pages are dropped, and the second part only if no range is left for it.
+ * @param pageNumber The page.
+ */
+void removeRangePage(uint64_t pageNumber) {
+    int range = findRange(pageNumber);
+    if (range == -1) {
+        return;
+    }
+    RangeEntry tail = ranges[range];
+    uint64_t headLength = pageNumber - tail.firstPage;
+    tail.firstPage = pageNumber + 1;
+    tail.firstFrame += headLength + 1;
+    tail.length -= headLength + 1;
+    if (headLength >= 2) {
+        ranges[range].length = headLength;
+    }
+    else {
+        removeRange(range);
+    }
+    if (tail.length >= 2) {
+        addRange(tail.firstPage, tail.firstFrame, tail.length);
+    }
+}
+
+/**
+ * This function links a frame to a table row and records it in the frame entries.
+ * @param tableIndex The table holding the row.
+ * @param rowAddress The address of the row.
+ * @param frameIndex The frame to link.
+ * @param level The level of the linked frame, TABLES_DEPTH for a page.
+ * @param path The path to the linked table, or the page number of the linked page.
+ * @return true if the frame was free and the zeroing thread zeroed it.
+ */
+bool linkFrame(uint64_t tableIndex, uint64_t rowAddress, uint64_t frameIndex, int level,
+               uint64_t path) {
+    if (level == TABLES_DEPTH && clusterSize > 1) {
+        // The frame of a page of a cluster with resident pages is at its slot from theirs
+        word_t row;
+        readRow(rowAddress, &row);
+        long long int baseFrameIndex = row == 0 ? (long long int)frameIndex - getClusterSlot(path) :
+                                       getClusterBase(row);
+        writeRow(rowAddress, makeClusterRow(baseFrameIndex,
+                                            getClusterMask(row) | 1ULL << getClusterSlot(path)));
+    }
+    else {
+        writeRow(rowAddress, (word_t)frameIndex);
+    }
+    if (frameEntries[tableIndex].numChildren++ == 0) {
+        numEmptyTables--;
+    }
+    FrameEntry &entry = frameEntries[frameIndex];
+    entry.parentAddress = (long long int)rowAddress;
+    entry.level = level;
+    entry.path = path;
+    entry.numChildren = 0;
+    bool zeroed = markFrameUsed((long long int)frameIndex);
+    if (level == TABLES_DEPTH) {
+        tableFrames.clear((long long int)frameIndex);
+        residentPages.set((long long int)path);
+        PageCandidate page;
+        page.pageNumber = path;
+        page.frameIndex = frameIndex;
+        page.parentFrameIndex = tableIndex;
+        page.cyclicDistance = (long long int)findCyclicDistance(victimCache.referencePage, path);
+        insertCachedVictim(page);
+        if (rangeTranslation) {
+            addRangePage(path, frameIndex);
+        }
+    }
+    else {
+        tableFrames.set((long long int)frameIndex);
+        numEmptyTables++;
+    }
+    return zeroed;
+}
+
+/**
+ * This function removes the row pointing to a frame, and records the frame's table as empty if it
+ * was the table's last child, since the next level may take it.
+ * @param candidates The gathered candidates.
+ * @param frameIndex The frame to unlink.
+ */
+void unlinkFrame(FrameCandidates &candidates, uint64_t frameIndex) {
+    FrameEntry &entry = frameEntries[frameIndex];
+    uint64_t rowAddress = (uint64_t)entry.parentAddress;
+    uint64_t tableIndex = rowAddress / PAGE_SIZE;
+    if (entry.level == TABLES_DEPTH && clusterSize > 1) {
+        word_t row;
+        readRow(rowAddress, &row);
+        uint64_t mask = getClusterMask(row) & ~(1ULL << getClusterSlot(entry.path));
+        writeRow(rowAddress, makeClusterRow(getClusterBase(row), mask));
+    }
+    else {
+        writeRow(rowAddress, 0);
+    }
+    if (--frameEntries[tableIndex].numChildren == 0) {
+        numEmptyTables++;
+        // A walk empties at most one table per level, so only callers outside walks fill this up
+        if (!pinnedFrames.test((long long int)tableIndex) &&
+            candidates.numEmptyTables < 2 * TABLES_DEPTH) {
+            candidates.emptyTables[candidates.numEmptyTables++] = tableIndex;
+        }
+    }
+    if (entry.level == TABLES_DEPTH) {
+        if (numRanges > 0) {
+            removeRangePage(entry.path);
+        }
+        residentPages.clear((long long int)entry.path);
+        removeCachedVictim(entry.path);
+        if (prefetchedPages.test((long long int)entry.path)) {
+            prefetchedPages.clear((long long int)entry.path);
+            recordReadahead(false);
+        }
+    }
+    else if (entry.numChildren == 0) {
+        numEmptyTables--;
+    }
+    entry.parentAddress = -1;
+}
+
+/**
+ * This function computes where a table comes in DFS order. Empty tables are never ancestors of
+ * each other, so aligning their paths to full page numbers orders them like the DFS does.
+ * @param frameIndex The table.
+ * @return The table's position key, the first page under it.
+ */
+uint64_t getTableKey(uint64_t frameIndex) {
+    const FrameEntry &entry = frameEntries[frameIndex];
+    return entry.path << ((TABLES_DEPTH - entry.level) * OFFSET_WIDTH + clusterShift);
+}
+
+/**
+ * This function takes the empty table which comes first in DFS order out of the candidates.
+ * @param candidates The gathered candidates.
+ * @param frameIndex The taken table.
+ * @return true if there was an empty table.
+ */
+bool takeEmptyTable(FrameCandidates &candidates, uint64_t &frameIndex) {
+    if (candidates.numEmptyTables == 0) {
+        return false;
+    }
+    int first = 0;
+    for (int i = 1; i < candidates.numEmptyTables; i++) {
+        if (getTableKey(candidates.emptyTables[i]) <
+            getTableKey(candidates.emptyTables[first])) {
+            first = i;
+        }
+    }
+    frameIndex = candidates.emptyTables[first];
+    candidates.emptyTables[first] = candidates.emptyTables[--candidates.numEmptyTables];
+    return true;
+}
+
+/**
+ * This function gathers the first empty tables in DFS order, by their position keys, leaving out
+ * the pinned ones. Only the first TABLES_DEPTH can be needed, one per missing level.
+ * @param candidates The candidates to gather them into.
+ * @param numTables The number of empty tables which are not pinned.
+ */
+void gatherEmptyTables(FrameCandidates &candidates, long long int numTables) {
+    long long int numFound = 0;
+    for (long long int frameIndex = tableFrames.findNext(1); frameIndex != -1 &&
+         numFound < numTables; frameIndex = tableFrames.findNext(frameIndex + 1)) {
+        if (frameEntries[frameIndex].numChildren != 0 || pinnedFrames.test(frameIndex)) {
+            continue;
+        }
+        numFound++;
+        uint64_t key = getTableKey((uint64_t)frameIndex);
+        int position = candidates.numEmptyTables;
+        while (position > 0 && getTableKey(candidates.emptyTables[position - 1]) > key) {
+            position--;
+        }
+        if (position >= TABLES_DEPTH) {
+            continue;
+        }
+        int last = candidates.numEmptyTables < TABLES_DEPTH ? candidates.numEmptyTables :
+                   TABLES_DEPTH - 1;
+        for (int i = last; i > position; i--) {
+            candidates.emptyTables[i] = candidates.emptyTables[i - 1];
+        }
+        candidates.emptyTables[position] = (uint64_t)frameIndex;
+        if (candidates.numEmptyTables < TABLES_DEPTH) {
+            candidates.numEmptyTables++;
+        }
+    }
+}
+
+/**
+ * This function removes a table left with a single child from the path compressed tree, linking
+ * the child in its place. The table's frame becomes free.
+ * @param tableIndex The table.
+ */
+void collapseTable(uint64_t tableIndex) {
+    FrameEntry &entry = frameEntries[tableIndex];
+    word_t child = 0;
+    for (int row = nextTableRow(tableIndex, 0); row < PAGE_SIZE && child == 0;
+         row = nextTableRow(tableIndex, row + 1)) {
+        readRow(tableIndex * PAGE_SIZE + row, &child);
+    }
+    writeRow((uint64_t)entry.parentAddress, child);
+    frameEntries[child].parentAddress = entry.parentAddress;
+    entry.parentAddress = -1;
+    entry.numChildren = 0;
+    tableFrames.clear((long long int)tableIndex);
+    if ((long long int)tableIndex < usableFrames) {
+        markFrameFree((long long int)tableIndex);
+    }
+}
+
+/**
+ * This function evicts a page to swap and unlinks its frame.
+ * @param candidates The gathered candidates.
+ * @param victim The page to evict.
+ */
+void evictPage(FrameCandidates &candidates, const PageCandidate &victim) {
+    if (evictionHook != nullptr) {
+        evictionHook(victim.pageNumber, victim.frameIndex);
+    }
+    PMevict(victim.frameIndex, victim.pageNumber);
+    swappedPages.set((long long int)victim.pageNumber);
+    uint64_t tableIndex = (uint64_t)frameEntries[victim.frameIndex].parentAddress / PAGE_SIZE;
+    unlinkFrame(candidates, victim.frameIndex);
+    if (pathCompression && tableIndex != 0 && frameEntries[tableIndex].numChildren == 1) {
+        collapseTable(tableIndex);
+    }
+}
+
+/**
+ * This function evicts the resident pages a leaf row points to. Their frames below a limit become
+ * free.
+ * @param candidates The gathered candidates.
+ * @param frameLimit The limit.
+ * @param row The row.
+ */
+void evictRowPages(FrameCandidates &candidates, long long int frameLimit, word_t row) {
+    long long int baseFrameIndex = getClusterBase(row);
+    for (uint64_t mask = getClusterMask(row); mask != 0; mask &= mask - 1) {
+        long long int frameIndex = baseFrameIndex + __builtin_ctzll(mask);
+        PageCandidate page;
+        page.pageNumber = frameEntries[frameIndex].path;
+        page.frameIndex = (uint64_t)frameIndex;
+        evictPage(candidates, page);
+        if (frameIndex < frameLimit) {
+            markFrameFree(frameIndex);
+        }
+    }
+}
+
+/**
+ * This function restores a page into its new frame. If the physical memory can have several
+ * restores in flight (PMqueueRestore), it only starts the restore, and the frame must not be
+ * accessed until finishRestores.
+ * @param frameIndex The frame.
+ * @param pageNumber The page.
+ * @return true if the page was in swap.
+ */
+bool restorePage(uint64_t frameIndex, uint64_t pageNumber) {
+    if (PMqueueRestore != nullptr && PMwaitRestores != nullptr) {
+        PMqueueRestore(frameIndex, pageNumber);
+    }
+    else {
+        PMrestore(frameIndex, pageNumber);
+    }
+    if (!swappedPages.test((long long int)pageNumber)) {
+        return false;
+    }
+    swappedPages.clear((long long int)pageNumber);
+    return true;
+}
+
+/**
+ * This function waits for the restores restorePage started.
+ */
+void finishRestores() {
+    if (PMqueueRestore != nullptr && PMwaitRestores != nullptr) {
+        PMwaitRestores();
+    }
+}
+
+/**
+ * This function takes the frame of a page whose cluster has resident pages, which the clustered
+ * layout fixes at the page's slot from theirs. A page held there is evicted to make room. If the
+ * frame is a table's or not usable, the cluster's resident pages are evicted instead, so the
+ * cluster is placed anew.
+ * @param candidates The gathered candidates.
+ * @param pageNumber The page.
+ * @param rowAddress The address of the cluster's row.
+ * @return The frame, -1 if the cluster has no resident pages (left).
+ */
+long long int takeClusterSlot(FrameCandidates &candidates, uint64_t pageNumber,
+                              uint64_t rowAddress) {
+    word_t row;
+    readRow(rowAddress, &row);
+    if (row == 0) {
+        return -1;
+    }
+    long long int frameIndex = getClusterBase(row) + getClusterSlot(pageNumber);
+    if (frameIndex >= 0 && frameIndex < usableFrames) {
+        if (freeFrames.test(frameIndex)) {
+            return frameIndex;
+        }
+        const FrameEntry &entry = frameEntries[frameIndex];
+        if (entry.level == TABLES_DEPTH) {
+            PageCandidate page;
+            page.pageNumber = entry.path;
+            page.frameIndex = (uint64_t)frameIndex;
+            evictPage(candidates, page);
+            return frameIndex;
+        }
+    }
+    evictRowPages(candidates, usableFrames, row);
+    return -1;
+}
+
+/**
+ * This function takes the frame of a page in the first aligned block of free frames, as many as a
+ * cluster has pages, so the rest of the page's cluster finds its frames free too.
+ * @param pageNumber The page.
+ * @return The frame, -1 if no block is free.
+ */
+long long int takeClusterBlock(uint64_t pageNumber) {
+    long long int freeFrameIndex = freeFrames.findNext(0);
+    while (freeFrameIndex != -1) {
+        long long int block = freeFrameIndex & ~(long long int)(clusterSize - 1);
+        long long int frameIndex = block;
+        while (frameIndex < block + clusterSize && frameIndex < usableFrames &&
+               freeFrames.test(frameIndex)) {
+            frameIndex++;
+        }
+        if (frameIndex == block + clusterSize) {
+            return block + getClusterSlot(pageNumber);
+        }
+        freeFrameIndex = block + clusterSize < usableFrames ?
+                         freeFrames.findNext(block + clusterSize) : -1;
+    }
+    return -1;
+}
+
+/**
+ * This function restores the swapped out pages of a page's cluster along with it, into their
+ * frames as long as those are free. The pages never evicted hold no data, so they are left to fault
+ * in when accessed. The restores are left in flight together with the page's.
+ * @param pageNumber The restored page.
+ * @param leafTable The leaf table pointing to it.
+ * @param rowAddress The address of the cluster's row.
+ */
+void faultCluster(uint64_t pageNumber, uint64_t leafTable, uint64_t rowAddress) {
+    word_t row;
+    readRow(rowAddress, &row);
+    long long int baseFrameIndex = getClusterBase(row);
+    uint64_t firstPage = pageNumber - (uint64_t)getClusterSlot(pageNumber);
+    for (long long int slot = 0; slot < clusterSize; slot++) {
+        uint64_t page = firstPage + (uint64_t)slot;
+        long long int frameIndex = baseFrameIndex + slot;
+        if (page >= NUM_PAGES || !swappedPages.test((long long int)page) || frameIndex < 0 ||
+            frameIndex >= usableFrames || !freeFrames.test(frameIndex)) {
+            continue;
+        }
+        linkFrame(leafTable, rowAddress, (uint64_t)frameIndex, TABLES_DEPTH, page);
+        restorePage((uint64_t)frameIndex, page);
+    }
+}
+
+/**
+ * This function restores the swapped out neighbours of a page which was just restored from swap,
+ * out of the rows of its leaf table within the readahead window, nearest first. Readahead is
+ * speculative, so it only takes free frames and stops when there are none left, rather than evict
+ * resident pages for pages which may never be accessed. The restores are left in flight together
+ * with the faulting page's.
+ * @param pageNumber The restored page.
+ * @param leafTable The leaf table pointing to it.
+ */
+void readAhead(uint64_t pageNumber, uint64_t leafTable) {
+    long long int row = (long long int)getOffset(pageNumber);
+    uint64_t firstPage = pageNumber - (uint64_t)row;
+    for (int step = 1; step <= 2 * readaheadWindow && freeFrames.numSet > 0; step++) {
+        long long int neighbourRow = step % 2 == 1 ? row + (step + 1) / 2 : row - step / 2;
+        uint64_t neighbour = firstPage + (uint64_t)neighbourRow;
+        if (neighbourRow < 0 || neighbourRow >= PAGE_SIZE || neighbour >= NUM_PAGES ||
+            !swappedPages.test((long long int)neighbour)) {
+            continue;
+        }
+        uint64_t frameIndex = (uint64_t)freeFrames.findNext(0);
+        linkFrame(leafTable, leafTable * PAGE_SIZE + (uint64_t)neighbourRow, frameIndex,
+                  TABLES_DEPTH, neighbour);
+        restorePage(frameIndex, neighbour);
+        prefetchedPages.set((long long int)neighbour);
+    }
+}
+
+/**
+ * This function evicts a table with its subtree: the resident pages in it go to swap and all its
+ * frames are unlinked. Tables hold nothing but the frames below them, so nothing else needs saving,
+ * and the walks rebuild them as needed. The frames below the limit become free.
+ * @param candidates The gathered candidates.
+ * @param frameLimit The limit.
+ * @param frameIndex The table.
+ */
+void evictTable(FrameCandidates &candidates, long long int frameLimit, uint64_t frameIndex) {
+    word_t value;
+    for (int row = nextTableRow(frameIndex, 0); row < PAGE_SIZE;
+         row = nextTableRow(frameIndex, row + 1)) {
+        readRow(frameIndex * PAGE_SIZE + row, &value);
+        if (value == 0) {
+            continue;
+        }
+        if (frameEntries[frameIndex].level == TABLES_DEPTH - 1 || !tableFrames.test(value)) {
+            evictRowPages(candidates, frameLimit, value);
+        }
+        else {
+            evictTable(candidates, frameLimit, (uint64_t)value);
+        }
+    }
+    unlinkFrame(candidates, frameIndex);
+    tableFrames.clear((long long int)frameIndex);
+    if ((long long int)frameIndex < frameLimit) {
+        markFrameFree((long long int)frameIndex);
+    }
+}
+
+/**
+ * This function evicts, instead of a victim page alone, its ancestor table at the table eviction
+ * level with its subtree, unless the page we translate is under that table too.
+ * @param candidates The gathered candidates, whose empty tables in the subtree are dropped.
+ * @param pageNumber The page number of the page we translate.
+ * @param victim The victim page.
+ * @return false if the page we translate is under the table, so the victim must be evicted alone.
+ */
+bool evictVictimTable(FrameCandidates &candidates, uint64_t pageNumber,
+                      const PageCandidate &victim) {
+    if (getTablePath(victim.pageNumber, tableEvictionLevel) ==
+        getTablePath(pageNumber, tableEvictionLevel)) {
+        return false;
+    }
+    uint64_t tableIndex = victim.frameIndex;
+    for (int level = TABLES_DEPTH; level > tableEvictionLevel; level--) {
+        tableIndex = (uint64_t)frameEntries[tableIndex].parentAddress / PAGE_SIZE;
+    }
+    evictTable(candidates, usableFrames, tableIndex);
+    int numEmptyTables = 0;
+    for (int i = 0; i < candidates.numEmptyTables; i++) {
+        if (frameEntries[candidates.emptyTables[i]].parentAddress != -1) {
+            candidates.emptyTables[numEmptyTables++] = candidates.emptyTables[i];
+        }
+    }
+    candidates.numEmptyTables = numEmptyTables;
+    return true;
+}
+
+/**
+ * This function is responsible for adding the frames/page for all the missing levels of a walk,
+ * from level down to the page itself. Each level takes the frame the exercise's priorities pick
+ * given the levels linked before it: the first empty table in DFS order (or one an eviction
+ * empties), the first free frame, or else the page the victim cache finds farthest, so the tree
+ * is not scanned. In the clustered layout a page whose cluster has resident pages must take its
+ * slot next to theirs, and otherwise a free block for its cluster comes before a lone free frame.
+ * @param pageNumber The page number of the page we translate.
+ * @param level The first missing level.
+ * @param currentFrameIndex The table the first missing level links into, updated to the page's
+ * frame.
+ * @param addressToAddTo The address of the row the first new frame is linked to.
+ */
+void addFrame(uint64_t pageNumber, int level, word_t &currentFrameIndex, uint64_t addressToAddTo) {
+    FrameCandidates candidates;
+    // The table we link into may be empty, so it must not be taken as an empty table
+    uint64_t tableToLink = (uint64_t)currentFrameIndex;
+    pinnedFrames.set((long long int)tableToLink);
+    long long int numOtherEmptyTables = numEmptyTables;
+    if (frameEntries[tableToLink].numChildren == 0) {
+        numOtherEmptyTables--;
+    }
+    if (numOtherEmptyTables > 0) {
+        gatherEmptyTables(candidates, numOtherEmptyTables);
+    }
+
+    for (; level < TABLES_DEPTH; level++) {
+        uint64_t frameIndex;
+        long long int freeFrameIndex;
+        bool zeroed = false;
+        if (clusterSize > 1 && level == TABLES_DEPTH - 1 &&
+            (freeFrameIndex = takeClusterSlot(candidates, pageNumber, addressToAddTo)) != -1) {
+            frameIndex = (uint64_t)freeFrameIndex;
+        }
+        else if (takeEmptyTable(candidates, frameIndex)) {
+            unlinkFrame(candidates, frameIndex);
+            // All its rows are 0, but without background zeroing the exercise's writes are kept
+            zeroed = zeroingThread.joinable();
+        }
+        else if (clusterSize > 1 && level == TABLES_DEPTH - 1 &&
+                 (freeFrameIndex = takeClusterBlock(pageNumber)) != -1) {
+            frameIndex = (uint64_t)freeFrameIndex;
+        }
+        else if ((freeFrameIndex = freeFrames.findNext(0)) != -1) { // If there is a free frame
+            frameIndex = (uint64_t)freeFrameIndex;
+        }
+        else { // There are no more unused frames
+            PageCandidate victim = takeCachedVictim(pageNumber);
+            if (tableEvictionLevel > 0 && evictVictimTable(candidates, pageNumber, victim)) {
+                frameIndex = (uint64_t)freeFrames.findNext(0);
+            }
+            else {
+                frameIndex = victim.frameIndex;
+                evictPage(candidates, victim);
+            }
+        }
+        uint64_t path = level == TABLES_DEPTH - 1 ? pageNumber :
+                        getTablePath(pageNumber, level + 1);
+        if (linkFrame(tableToLink, addressToAddTo, frameIndex, level + 1, path)) {
+            zeroed = true;
+        }
+        currentFrameIndex = (word_t)frameIndex;
+        pinnedFrames.clear((long long int)tableToLink);
+        if (level == TABLES_DEPTH - 1) {
+            bool swapped = restorePage(frameIndex, pageNumber);
+            if (swapped && clusterSize > 1) {
+                faultCluster(pageNumber, tableToLink, addressToAddTo);
+            }
+            else if (swapped && readaheadWindow > 0) {
+                readAhead(pageNumber, tableToLink);
+            }
+            if (!batchingRestores) {
+                finishRestores();
+            }
+        }
+        else {
+            if (!zeroed) {
+                resetTable(frameIndex);
+            }
+            tableToLink = frameIndex;
+            pinnedFrames.set((long long int)tableToLink);
+            addressToAddTo = frameIndex * PAGE_SIZE + getTableOffset(pageNumber, level + 1);
+        }
+    }
+}
+
+/**
+ * This function moves a table to another frame, along with its rows.
+ * @param frameIndex The table's frame.
+ * @param newFrameIndex The frame it moves to.
+ */
+void moveTable(uint64_t frameIndex, uint64_t newFrameIndex) {
+    // Claimed before its rows are written, or the zeroing thread could zero it under them
+    markFrameUsed((long long int)newFrameIndex);
+    // A leaf row points to the frames of its resident pages, any other row to one table
+    bool isLeaf = frameEntries[frameIndex].level == TABLES_DEPTH - 1;
+    word_t value;
+    for (int row = 0; row < PAGE_SIZE; row++) {
+        readRow(frameIndex * PAGE_SIZE + row, &value);
+        writeRow(newFrameIndex * PAGE_SIZE + row, value);
+        long long int childIndex = isLeaf ? getClusterBase(value) : value;
+        for (uint64_t mask = isLeaf ? getClusterMask(value) : value != 0; mask != 0;
+             mask &= mask - 1) {
+            frameEntries[childIndex + __builtin_ctzll(mask)].parentAddress =
+                    (long long int)(newFrameIndex * PAGE_SIZE + row);
+        }
+    }
+    writeRow((uint64_t)frameEntries[frameIndex].parentAddress, (word_t)newFrameIndex);
+    frameEntries[newFrameIndex] = frameEntries[frameIndex];
+    frameEntries[frameIndex].parentAddress = -1;
+    tableFrames.set((long long int)newFrameIndex);
+    tableFrames.clear((long long int)frameIndex);
+}
+
+/**
+ * This function takes a frame below a limit for a table which must move there, by the exercise's
+ * priorities: an empty table, a free frame, or the page farthest from the table.
+ * @param candidates The gathered candidates.
+ * @param frameLimit The limit.
+ * @param tableIndex The table which moves.
+ * @param frameIndex The taken frame.
+ * @return false if there is none, since no page is resident and no empty table is below the limit.
+ */
+bool takeFrameBelow(FrameCandidates &candidates, long long int frameLimit, uint64_t tableIndex,
+                    uint64_t &frameIndex) {
+    for (long long int emptyIndex = tableFrames.findNext(1); emptyIndex != -1 &&
+         emptyIndex < frameLimit; emptyIndex = tableFrames.findNext(emptyIndex + 1)) {
+        if (frameEntries[emptyIndex].numChildren == 0) {
+            unlinkFrame(candidates, (uint64_t)emptyIndex);
+            tableFrames.clear(emptyIndex);
+            frameIndex = (uint64_t)emptyIndex;
+            return true;
+        }
+    }
+    long long int freeFrameIndex = freeFrames.findNext(0);
+    if (freeFrameIndex != -1) {
+        frameIndex = (uint64_t)freeFrameIndex;
+        return true;
+    }
+    if (residentPages.numSet == 0) {
+        return false;
+    }
+    PageCandidate victim = takeCachedVictim(getTableKey(tableIndex));
+    evictPage(candidates, victim);
+    frameIndex = victim.frameIndex;
+    return true;
+}
+
+int VMsetFrameLimit(long long int frameLimit) {
+    if (frameLimit <= TABLES_DEPTH || frameLimit > NUM_FRAMES) {
+        return 0;
+    }
+    for (long long int frameIndex = usableFrames; frameIndex < frameLimit; frameIndex++) {
+        markFrameFree(frameIndex);
+    }
+    for (long long int frameIndex = frameLimit; frameIndex < usableFrames; frameIndex++) {
+        markFrameUsed(frameIndex);
+    }
+    // The frames the evictions below free only become free below the new limit
+    long long int previousUsableFrames = usableFrames;
+    usableFrames = frameLimit;
+    FrameCandidates candidates;
+    for (long long int frameIndex = frameLimit; frameIndex < previousUsableFrames; frameIndex++) {
+        const FrameEntry &entry = frameEntries[frameIndex];
+        if (entry.parentAddress != -1 && entry.level == TABLES_DEPTH) {
+            PageCandidate page;
+            page.pageNumber = entry.path;
+            page.frameIndex = (uint64_t)frameIndex;
+            evictPage(candidates, page);
+        }
+    }
+    // Dropping an empty table may empty its parent, so repeat until nothing is dropped
+    bool droppedTable = true;
+    while (droppedTable) {
+        droppedTable = false;
+        for (long long int frameIndex = tableFrames.findNext(frameLimit); frameIndex != -1;
+             frameIndex = tableFrames.findNext(frameIndex + 1)) {
+            if (frameEntries[frameIndex].numChildren == 0) {
+                unlinkFrame(candidates, (uint64_t)frameIndex);
+                tableFrames.clear(frameIndex);
+                droppedTable = true;
+            }
+        }
+    }
+    // Only tables are left at or above the limit
+    for (long long int frameIndex = tableFrames.findNext(frameLimit); frameIndex != -1;
+         frameIndex = tableFrames.findNext(frameIndex + 1)) {
+        uint64_t newFrameIndex;
+        // Without resident pages every table only leads to swap, so it can go
+        if (!takeFrameBelow(candidates, frameLimit, (uint64_t)frameIndex, newFrameIndex)) {
+            evictTable(candidates, frameLimit, (uint64_t)frameIndex);
+        }
+        else if (frameEntries[frameIndex].parentAddress == -1) { // The eviction collapsed it
+            markFrameFree((long long int)newFrameIndex);
+        }
+        else {
+            moveTable((uint64_t)frameIndex, newFrameIndex);
+        }
+    }
+    return 1;
+}
+
+/**
+ * This function accounts for an access to a resident page, which is a readahead hit if the page was
+ * prefetched.
+ * @param pageNumber The page.
+ */
+void recordAccess(uint64_t pageNumber) {
+    if (prefetchedPages.numSet > 0 && prefetchedPages.test((long long int)pageNumber)) {
+        prefetchedPages.clear((long long int)pageNumber);
+        recordReadahead(true);
+    }
+}
+
+/**
+ * This function faults in a page known not to be resident. Some level of its path is missing, so
+ * the walk only looks for the deepest table on the path, where the missing levels start, and
+ * leaves out the accounting of an access.
+ * @param pageNumber The page.
+ * @param frameIndex The page's frame.
+ */
+void faultPage(uint64_t pageNumber, word_t &frameIndex) {
+    int level = 0;
+    uint64_t rowAddress = getTableOffset(pageNumber, 0);
+    word_t child;
+    readRow(rowAddress, &child);
+    // A leaf row of the clustered layout may hold other pages of the cluster
+    while (child != 0 && level < TABLES_DEPTH - 1) {
+        frameIndex = child;
+        level++;
+        rowAddress = frameIndex * PAGE_SIZE + getTableOffset(pageNumber, level);
+        readRow(rowAddress, &child);
+    }
+    addFrame(pageNumber, level, frameIndex, rowAddress);
+}
+
+/**
+ * This function takes a frame for the path compressed tree: a free frame, or else the frame of the
+ * page farthest from the faulting page (whose eviction may collapse its table, freeing a frame).
+ * @param pageNumber The faulting page.
+ * @return The frame.
+ */
+uint64_t takeCompressedFrame(uint64_t pageNumber) {
+    long long int freeFrameIndex = freeFrames.findNext(0);
+    if (freeFrameIndex != -1) {
+        markFrameUsed(freeFrameIndex);
+        return (uint64_t)freeFrameIndex;
+    }
+    FrameCandidates candidates;
+    PageCandidate victim = takeCachedVictim(pageNumber);
+    evictPage(candidates, victim);
+    return victim.frameIndex;
+}
+
+/**
+ * This function faults in a page in the path compressed tree. If the walk ends at an empty row,
+ * the page is linked there directly. If it ends at a frame off the page's path, a table is
+ * inserted at the first level where their paths differ, holding both. Taking frames may change the
+ * tree, so the walk is repeated until the frames taken suffice.
+ * @param pageNumber The page.
+ * @return The page's frame.
+ */
+uint64_t faultCompressedPage(uint64_t pageNumber) {
+    uint64_t frames[2];
+    int numFrames = 0;
+    uint64_t rowAddress;
+    word_t child;
+    while (true) {
+        walkCompressed(pageNumber, rowAddress, child);
+        if (numFrames >= (child == 0 ? 1 : 2)) {
+            break;
+        }
+        frames[numFrames++] = takeCompressedFrame(pageNumber);
+    }
+    uint64_t pageFrameIndex = frames[numFrames - 1];
+    uint64_t tableIndex = rowAddress / PAGE_SIZE;
+    if (child != 0) {
+        // The new table goes at the first level where the paths differ
+        const FrameEntry &childEntry = frameEntries[child];
+        uint64_t childPath = childEntry.path << ((TABLES_DEPTH - (std::size_t)childEntry.level) *
+                                                 OFFSET_WIDTH);
+        int level = frameEntries[tableIndex].level + 1;
+        while (getTableOffset(childPath, level) == getTableOffset(pageNumber, level)) {
+            level++;
+        }
+        uint64_t newTableIndex = frames[0];
+        resetTable(newTableIndex);
+        writeRow(rowAddress, (word_t)newTableIndex);
+        FrameEntry &entry = frameEntries[newTableIndex];
+        entry.parentAddress = (long long int)rowAddress;
+        entry.level = level;
+        entry.path = pageNumber >> ((TABLES_DEPTH - (std::size_t)level) * OFFSET_WIDTH);
+        entry.numChildren = 1;
+        tableFrames.set((long long int)newTableIndex);
+        uint64_t childRowAddress = newTableIndex * PAGE_SIZE + getTableOffset(childPath, level);
+        writeRow(childRowAddress, child);
+        frameEntries[child].parentAddress = (long long int)childRowAddress;
+        tableIndex = newTableIndex;
+        rowAddress = newTableIndex * PAGE_SIZE + getTableOffset(pageNumber, level);
+    }
+    else if (numFrames == 2) { // The walk changed, so one frame is left over
+        markFrameFree((long long int)frames[0]);
+    }
+    linkFrame(tableIndex, rowAddress, pageFrameIndex, TABLES_DEPTH, pageNumber);
+    restorePage(pageFrameIndex, pageNumber);
+    if (!batchingRestores) {
+        finishRestores();
+    }
+    return pageFrameIndex;
+}
+
+uint64_t translateVirtualAddress(uint64_t virtualAddress){
+    uint64_t pageNumber = virtualAddress >> OFFSET_WIDTH;
+    word_t frameIndex = 0; // initialize frame address to point to frame 0
+    if (numRanges > 0) {
+        int range = findRange(pageNumber);
+        if (range != -1) {
+            recordAccess(pageNumber);
+            return (ranges[range].firstFrame + pageNumber - ranges[range].firstPage) * PAGE_SIZE +
+                   getOffset(virtualAddress);
+        }
+    }
+    if (pathCompression) {
+        uint64_t rowAddress;
+        walkCompressed(pageNumber, rowAddress, frameIndex);
+        if (frameIndex == 0 || frameEntries[frameIndex].level != TABLES_DEPTH ||
+            frameEntries[frameIndex].path != pageNumber) {
+            long long int stallStart = pressureClock();
+            frameIndex = (word_t)faultCompressedPage(pageNumber);
+            recordStall(stallStart);
+        }
+        else {
+            recordAccess(pageNumber);
+        }
+        return frameIndex * PAGE_SIZE + getOffset(virtualAddress);
+    }
+    if (!residentPages.test((long long int)pageNumber)) {
+        long long int stallStart = pressureClock();
+        faultPage(pageNumber, frameIndex);
+        recordStall(stallStart);
+        return frameIndex * PAGE_SIZE + getOffset(virtualAddress);
+    }
+    // The page is resident, so every row on its path is set
+    for (int level = 0; level < TABLES_DEPTH; level++) {
+        readRow(frameIndex * PAGE_SIZE + getTableOffset(pageNumber, level), &frameIndex);
+    }
+    if (clusterSize > 1) {
+        frameIndex = getPageFrame(frameIndex, pageNumber);
+    }
+    recordAccess(pageNumber);
+    uint64_t pageOffset = getOffset(virtualAddress);
+    return (frameIndex * PAGE_SIZE) + pageOffset;
+}
+
+void setNativeAccess(word_t *region, EvictionHook hook) {
+    nativeRegion = region;
+    evictionHook = hook;
+}
+
+int VMread(uint64_t virtualAddress, word_t* value) {
+    if(!value || virtualAddress >= VIRTUAL_MEMORY_SIZE){
+        return 0;
+    }
+    if (nativeRegion != nullptr) { // The region faults the page in if needed
+        *value = nativeRegion[virtualAddress];
+        return 1;
+    }
+
+    uint64_t physicalAddress = translateVirtualAddress(virtualAddress);
+    PMread(physicalAddress, value);
+    return 1;
+}
+
+int VMwrite(uint64_t virtualAddress, word_t value){
+    if(virtualAddress >= VIRTUAL_MEMORY_SIZE){
+        return 0;
+    }
+    if (nativeRegion != nullptr) {
+        nativeRegion[virtualAddress] = value;
+        return 1;
+    }
+
+    uint64_t physicalAddress = translateVirtualAddress(virtualAddress);
+    PMwrite(physicalAddress, value);
+    return 1;
+}
+
+#ifdef __SSE2__
+/**
+ * This function is the AVX2 part of decomposeAddresses, compiled for AVX2 whatever the build's
+ * flags, so it must only run on hosts which have it. It splits the addresses 4 at a time, as far
+ * as whole groups of 4 go.
+ * @param virtualAddresses The addresses.
+ * @param count The number of addresses.
+ * @param rows The row of address i in level's table, at rows[level][i].
+ * @param offsets The page offset of address i, at offsets[i].
+ * @return The number of addresses split.
+ */
+__attribute__((target("avx2")))
+int decomposeAddressesAvx2(const uint64_t *virtualAddresses, int count,
+                           uint64_t rows[TABLES_DEPTH][DECOMPOSE_CHUNK],
+                           uint64_t offsets[DECOMPOSE_CHUNK]) {
+    const __m256i mask = _mm256_set1_epi64x((1LL << OFFSET_WIDTH) - 1);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i addresses = _mm256_loadu_si256((const __m256i *)(virtualAddresses + i));
+        _mm256_storeu_si256((__m256i *)(offsets + i), _mm256_and_si256(addresses, mask));
+        for (int level = TABLES_DEPTH - 1; level >= 0; level--) {
+            addresses = _mm256_srli_epi64(addresses, OFFSET_WIDTH);
+            _mm256_storeu_si256((__m256i *)(rows[level] + i), _mm256_and_si256(addresses, mask));
+        }
+    }
+    return i;
+}
+#endif
+
+/**
+ * This function splits up to DECOMPOSE_CHUNK virtual addresses into their row in every level's
+ * table and their page offset, shifting and masking as many addresses at once as the host's vector
+ * registers hold: 4 on hosts with AVX2, which is detected at run time, and otherwise 2 with SSE2.
+ * @param virtualAddresses The addresses.
+ * @param count The number of addresses.
+ * @param rows The row of address i in level's table, at rows[level][i].
+ * @param offsets The page offset of address i, at offsets[i].
+ */
+void decomposeAddresses(const uint64_t *virtualAddresses, int count,
+                        uint64_t rows[TABLES_DEPTH][DECOMPOSE_CHUNK],
+                        uint64_t offsets[DECOMPOSE_CHUNK]) {
+    int i = 0;
+#ifdef __SSE2__
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if (hasAvx2) {
+        i = decomposeAddressesAvx2(virtualAddresses, count, rows, offsets);
+    }
+    const __m128i mask = _mm_set1_epi64x((1LL << OFFSET_WIDTH) - 1);
+    for (; i + 2 <= count; i += 2) {
+        __m128i addresses = _mm_loadu_si128((const __m128i *)(virtualAddresses + i));
+        _mm_storeu_si128((__m128i *)(offsets + i), _mm_and_si128(addresses, mask));
+        for (int level = TABLES_DEPTH - 1; level >= 0; level--) {
+            addresses = _mm_srli_epi64(addresses, OFFSET_WIDTH);
+            _mm_storeu_si128((__m128i *)(rows[level] + i), _mm_and_si128(addresses, mask));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        uint64_t pageNumber = virtualAddresses[i] >> OFFSET_WIDTH;
+        offsets[i] = getOffset(virtualAddresses[i]);
+        for (int level = 0; level < TABLES_DEPTH; level++) {
+            rows[level][i] = getTableOffset(pageNumber, level);
+        }
+    }
+}
+
+/**
+ * The state of one of the walks VMreadBatch interleaves: the address it serves with its rows and
+ * page offset, the level of the row it reads next (TABLES_DEPTH for the word itself), and the frame
+ * that row is in.
+ */
+struct BatchWalk {
+    int index;
+    uint64_t rows[TABLES_DEPTH];
+    uint64_t offset;
+    int level;
+    word_t frameIndex;
+};
+
+/**
+ * This function gives the physical address a walk reads next.
+ * @param walk The walk.
+ * @return The physical address.
+ */
+uint64_t getWalkAddress(const BatchWalk &walk) {
+    return walk.frameIndex * PAGE_SIZE +
+           (walk.level == TABLES_DEPTH ? walk.offset : walk.rows[walk.level]);
+}
+
+/**
+ * This function prefetches the physical address a walk reads next, if the physical memory can.
+ * @param walk The walk.
+ */
+void prefetchWalk(const BatchWalk &walk) {
+    if (PMprefetch != nullptr) {
+        PMprefetch(getWalkAddress(walk));
+    }
+}
+
+/**
+ * An address of a batch along with its position in it.
+ */
+struct BatchEntry {
+    uint64_t virtualAddress;
+    int index;
+};
+
+/**
+ * This function reads a large batch sorted by page number: a radix sort (RADIX_BITS of the page
+ * number per pass, carrying the positions) groups the addresses of each page, so each page is
+ * translated once, and the walks visit the tables in DFS order. The words are then scattered back
+ * to their positions. Where the physical memory can have several restores in flight, the pages are
+ * faulted in BATCH_RESTORE_GROUP at a time before their restores are waited for; a page evicted by
+ * a later fault of its group is translated again.
+ * @param virtualAddresses The addresses.
+ * @param values The words read.
+ * @param count The number of addresses.
+ */
+void readSortedBatch(const uint64_t *virtualAddresses, word_t *values, int count) {
+    std::vector<BatchEntry> entries((std::size_t)count);
+    std::vector<BatchEntry> sortedEntries((std::size_t)count);
+    for (int i = 0; i < count; i++) {
+        entries[i].virtualAddress = virtualAddresses[i];
+        entries[i].index = i;
+    }
+    for (int shift = OFFSET_WIDTH; shift < VIRTUAL_ADDRESS_WIDTH; shift += RADIX_BITS) {
+        int digitCounts[(1 << RADIX_BITS) + 1] = {0};
+        for (int i = 0; i < count; i++) {
+            digitCounts[((entries[i].virtualAddress >> shift) & ((1 << RADIX_BITS) - 1)) + 1]++;
+        }
+        for (int digit = 0; digit < 1 << RADIX_BITS; digit++) {
+            digitCounts[digit + 1] += digitCounts[digit];
+        }
+        for (int i = 0; i < count; i++) {
+            int digit = (int)((entries[i].virtualAddress >> shift) & ((1 << RADIX_BITS) - 1));
+            sortedEntries[digitCounts[digit]++] = entries[i];
+        }
+        entries.swap(sortedEntries);
+    }
+    int groupSize = PMqueueRestore != nullptr && PMwaitRestores != nullptr ?
+                    BATCH_RESTORE_GROUP : 1;
+    uint64_t frameIndices[BATCH_RESTORE_GROUP];
+    for (int i = 0; i < count;) {
+        int groupStart = i;
+        batchingRestores = true;
+        for (int page = 0; page < groupSize && i < count; page++) {
+            uint64_t pageNumber = entries[i].virtualAddress >> OFFSET_WIDTH;
+            frameIndices[page] = translateVirtualAddress(entries[i].virtualAddress) / PAGE_SIZE;
+            while (i < count && entries[i].virtualAddress >> OFFSET_WIDTH == pageNumber) {
+                i++;
+            }
+        }
+        batchingRestores = false;
+        finishRestores();
+        for (int page = 0; groupStart < i; page++) {
+            uint64_t pageNumber = entries[groupStart].virtualAddress >> OFFSET_WIDTH;
+            const FrameEntry &entry = frameEntries[frameIndices[page]];
+            if (entry.parentAddress == -1 || entry.level != TABLES_DEPTH ||
+                entry.path != pageNumber) {
+                frameIndices[page] = translateVirtualAddress(pageNumber << OFFSET_WIDTH) /
+                                     PAGE_SIZE;
+            }
+            for (; groupStart < i &&
+                   entries[groupStart].virtualAddress >> OFFSET_WIDTH == pageNumber; groupStart++) {
+                PMread(frameIndices[page] * PAGE_SIZE +
+                       getOffset(entries[groupStart].virtualAddress),
+                       &values[entries[groupStart].index]);
+            }
+        }
+    }
+}
+
+int VMreadBatch(const uint64_t *virtualAddresses, word_t *values, int count) {
+    if (virtualAddresses == nullptr || values == nullptr || count < 0) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (virtualAddresses[i] >= VIRTUAL_MEMORY_SIZE) {
+            return 0;
+        }
+    }
+    if (nativeRegion != nullptr) {
+        for (int i = 0; i < count; i++) {
+            values[i] = nativeRegion[virtualAddresses[i]];
+        }
+        return 1;
+    }
+    // The interleaved walks assume a row at every level, holding the frame of the next one
+    if (count >= BATCH_SORT_THRESHOLD || pathCompression || clusterSize > 1) {
+        readSortedBatch(virtualAddresses, values, count);
+        return 1;
+    }
+
+    // Each round advances every walk by one row, which was prefetched a round earlier
+    BatchWalk walks[BATCH_WALKS];
+    int numWalks = 0;
+    int nextIndex = 0;
+    // The addresses are decomposed a chunk at a time, from chunkStart on
+    uint64_t rows[TABLES_DEPTH][DECOMPOSE_CHUNK];
+    uint64_t offsets[DECOMPOSE_CHUNK];
+    int chunkStart = 0;
+    int chunkSize = 0;
+    while (nextIndex < count || numWalks > 0) {
+        while (numWalks < BATCH_WALKS && nextIndex < count) {
+            if (nextIndex == chunkStart + chunkSize) {
+                chunkStart = nextIndex;
+                chunkSize = count - chunkStart < DECOMPOSE_CHUNK ? count - chunkStart :
+                            DECOMPOSE_CHUNK;
+                decomposeAddresses(virtualAddresses + chunkStart, chunkSize, rows, offsets);
+            }
+            BatchWalk &walk = walks[numWalks++];
+            walk.index = nextIndex++;
+            for (int level = 0; level < TABLES_DEPTH; level++) {
+                walk.rows[level] = rows[level][walk.index - chunkStart];
+            }
+            walk.offset = offsets[walk.index - chunkStart];
+            walk.level = 0;
+            walk.frameIndex = 0;
+            uint64_t pageNumber = virtualAddresses[walk.index] >> OFFSET_WIDTH;
+            int range = numRanges > 0 ? findRange(pageNumber) : -1;
+            if (range != -1) { // Straight to the word
+                walk.level = TABLES_DEPTH;
+                walk.frameIndex = (word_t)(ranges[range].firstFrame + pageNumber -
+                                           ranges[range].firstPage);
+            }
+            prefetchWalk(walk);
+        }
+        for (int i = 0; i < numWalks; i++) {
+            BatchWalk &walk = walks[i];
+            uint64_t virtualAddress = virtualAddresses[walk.index];
+            uint64_t physicalAddress = getWalkAddress(walk); // Prefetched a round earlier
+            if (walk.level == TABLES_DEPTH) {
+                PMread(physicalAddress, &values[walk.index]);
+                recordAccess(virtualAddress >> OFFSET_WIDTH);
+                walks[i--] = walks[--numWalks];
+                continue;
+            }
+            readRow(physicalAddress, &walk.frameIndex);
+            if (walk.frameIndex != 0) {
+                walk.level++;
+                prefetchWalk(walk);
+                continue;
+            }
+            // The fault may take the frames of the other walks, so they start over
+            PMread(translateVirtualAddress(virtualAddress), &values[walk.index]);
+            walks[i] = walks[--numWalks];
+            for (int j = 0; j < numWalks; j++) {
+                walks[j].level = 0;
+                walks[j].frameIndex = 0;
+                prefetchWalk(walks[j]);
+            }
+            break;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "MemoryConstants.h"
+
+/**
+ * Extensions to the VirtualMemory.h interface. They are all optional: without calling them the
+ * library behaves exactly as the exercise specifies.
+ */
+
+/**
+ * This function sets up swap-in readahead. When a fault restores a page from swap, its swapped out
+ * neighbours in the same leaf table are restored along with it, nearest first, into free frames
+ * (readahead stops when none are left, and never evicts resident pages to make room). The
+ * window adapts between 1 and maxWindow: it grows while more prefetched pages are accessed than
+ * evicted unaccessed, and shrinks otherwise.
+ * @param maxWindow The most neighbours restored on each side of a page, 0 to disable readahead.
+ */
+void VMsetReadahead(int maxWindow);
+
+/**
+ * This function reports how readahead has done since VMinitialize.
+ * @param hits The number of prefetched pages accessed before being evicted.
+ * @param waste The number of prefetched pages evicted without being accessed.
+ * @param window The current window.
+ */
+void VMgetReadaheadStats(long long int *hits, long long int *waste, int *window);
+
+/**
+ * This function changes how many frames the library may use, without losing any data. Shrinking
+ * evicts the pages held in frames at or above the limit, drops the empty tables there and moves
+ * the other tables below the limit, taking frames for them as a fault would (evicting pages if
+ * needed). Growing makes the frames up to the new limit immediately available. The limit stays in
+ * effect across VMinitialize.
+ * @param frameLimit The number of usable frames, between TABLES_DEPTH + 1 and NUM_FRAMES.
+ * @return 1 on success, 0 if the limit is out of range.
+ */
+int VMsetFrameLimit(long long int frameLimit);
+
+/**
+ * Called when a memory pressure trigger's threshold is reached. It runs inside the faulting
+ * VMread/VMwrite (or the native access fault handler), so it must not call the library.
+ * @param context The context given when the trigger was added.
+ */
+typedef void (*PressureCallback)(void *context);
+
+/**
+ * This function reports how much time callers spent stalled in faults (walking, evicting and
+ * restoring pages), like the kernel's pressure stall information: the share of time stalled, as a
+ * percentage averaged over the last 10, 60 and 300 seconds, and the total stall time since
+ * VMinitialize.
+ * @param avg10 The average over 10 seconds.
+ * @param avg60 The average over 60 seconds.
+ * @param avg300 The average over 300 seconds.
+ * @param total The total stall time, in microseconds.
+ */
+void VMgetPressure(double *avg10, double *avg60, double *avg300, long long int *total);
+
+/**
+ * This function adds a trigger which calls back once callers were stalled in faults for
+ * stallThreshold microseconds within a sliding window of window microseconds. It fires at most once
+ * per window, and stays in effect across VMinitialize.
+ * @param stallThreshold The stall time, in microseconds, between 1 and window.
+ * @param window The window, in microseconds.
+ * @param callback The callback.
+ * @param context Passed to the callback.
+ * @return The trigger's id, or -1 if the arguments are invalid or there are too many triggers.
+ */
+int VMaddPressureTrigger(long long int stallThreshold, long long int window,
+                         PressureCallback callback, void *context);
+
+/**
+ * This function removes a trigger added by VMaddPressureTrigger.
+ * @param trigger The trigger's id.
+ */
+void VMremovePressureTrigger(int trigger);
+
+/**
+ * This function makes faults which must evict a page evict the page's ancestor table at a given
+ * level instead, along with everything under it: its pages go to swap and its tables are dropped,
+ * to be rebuilt by the walks which need them again. Cold parts of a sparse address space then stop
+ * holding frames in tables. The victim page alone is evicted if the faulting page is under the
+ * same table.
+ * @param level The level of the evicted tables, from 1 (the root's children) to TABLES_DEPTH - 1
+ * (the tables pointing to pages), or 0 to evict pages alone.
+ */
+void VMsetTableEviction(int level);
+
+/**
+ * This function starts a background thread which zeroes free frames ahead of time, so the faults
+ * which link them as tables skip zeroing them. Empty tables taken for another level are also
+ * linked without being zeroed again. It must be called after VMinitialize, and PMwrite must
+ * allow writes to different frames from different threads.
+ * @param poolSize The most zeroed free frames kept.
+ * @return 1 if the thread started, 0 if it is already running or poolSize is not positive.
+ */
+int VMstartZeroing(long long int poolSize);
+
+/**
+ * This function stops the zeroing thread started by VMstartZeroing. A thread still running when
+ * the program exits is stopped then.
+ */
+void VMstopZeroing();
+
+/**
+ * This function sets up lazy zeroing of tables, from the next VMinitialize on. Each frame gets a
+ * generation, and a table row reads as 0 unless it was written since the frame's generation last
+ * changed, so making a frame an empty table only changes its generation instead of writing its
+ * PAGE_SIZE rows, and scanning a table skips the rows never written. Rows set to 0 are not written
+ * either, so table rows in physical memory are only meaningful through the library.
+ * @param enable Nonzero to zero tables lazily.
+ */
+void VMsetLazyZeroing(int enable);
+
+/**
+ * This function reads many words at once. Up to BATCH_WALKS page walks are interleaved, each
+ * advancing by one table row per round, so the rows they read next can be prefetched (if the
+ * physical memory supports it) and loaded in parallel instead of one dependent read at a time.
+ * A walk reaching a missing row faults in as VMread would, and the other walks in flight then
+ * start over. Batches of at least BATCH_SORT_THRESHOLD addresses are radix sorted by page number
+ * first instead, so each page is translated once and the tables are visited in DFS order. The words
+ * may be read in a different order than given.
+ * @param virtualAddresses The addresses.
+ * @param values The words read, in the order of the addresses.
+ * @param count The number of addresses.
+ * @return 1 on success, 0 if an address is invalid (nothing is read then).
+ */
+int VMreadBatch(const uint64_t *virtualAddresses, word_t *values, int count);
+
+/**
+ * This function sets up a path compressed page table, from the next VMinitialize on. As in an
+ * adaptive radix tree, chains of tables with a single child collapse: a row points straight to the
+ * next table with several children, or to the page itself, and a table is only inserted where the
+ * paths of two pages part. Walks get shorter and sparse address spaces use far fewer table frames.
+ * Faults take a free frame or evict the page farthest from the faulting one, since no table is ever
+ * empty. Readahead and table eviction do not apply to this table, and VMreadBatch does not
+ * interleave its walks.
+ * @param enable Nonzero for the path compressed table.
+ */
+void VMsetPathCompression(int enable);
+
+/**
+ * This function turns range translation on or off. A range entry maps a run of consecutive
+ * resident pages held by consecutive frames, as sequential faults into free frames tend to leave
+ * them, and translation looks the page up among the (at most MAX_RANGES) ranges before walking the
+ * table. Ranges are created and extended as pages are linked next to their neighbours' frames,
+ * split as pages are evicted, and the shortest gives way to a longer one when all are taken.
+ * @param enable Nonzero to use range entries.
+ */
+void VMsetRangeTranslation(int enable);
+
+/**
+ * This function sets up a clustered page table, from the next VMinitialize on. The pages are
+ * grouped into aligned clusters of numPages, and a leaf row maps a whole cluster: it holds the
+ * frame of the cluster's first page and a mask of its resident pages, each in the frame at its
+ * slot from the first one. A leaf table then covers PAGE_SIZE * numPages pages, so the leaf tables
+ * of a dense address space take about numPages times fewer frames. A cluster's first page takes its
+ * slot in a block of free frames if one is left, and a page restored from swap brings the other
+ * swapped out pages of its cluster along. A page whose frame is held by another page evicts it,
+ * and one whose frame is a table's (or beyond the frame limit) evicts its cluster, which is then
+ * placed anew. Readahead does not apply to this table, VMreadBatch does not interleave its walks,
+ * and path compression takes precedence over it.
+ * @param numPages The pages per cluster, a power of two (1 for the plain table), as long as a leaf
+ * row fits in a word: (NUM_FRAMES + numPages) << numPages must not exceed the largest word.
+ * @return 1 on success, 0 if numPages is invalid.
+ */
+int VMsetClusterSize(int numPages);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "MemoryConstants.h"
+
+/**
+ * The parts of the paging engine shared between the library's own source files. They are not part
+ * of the VirtualMemory.h interface.
+ */
+
+// The bytes of a page or frame
+#define PAGE_BYTES (PAGE_SIZE * sizeof(word_t))
+
+/**
+ * This function reports a failed system call with its errno and exits, for the failures the
+ * library cannot recover from.
+ * @param message The failed operation.
+ */
+void systemError(const char *message);
+
+/**
+ * Called right before a resident page is evicted from its frame.
+ * @param pageNumber The evicted page.
+ * @param frameIndex The frame it is evicted from.
+ */
+typedef void (*EvictionHook)(uint64_t pageNumber, uint64_t frameIndex);
+
+/**
+ * This function translates a virtual address, faulting in its page (and any missing tables) if it
+ * is not resident.
+ * @param virtualAddress The virtual address.
+ * @return The physical address.
+ */
+uint64_t translateVirtualAddress(uint64_t virtualAddress);
+
+/**
+ * This function routes VMread/VMwrite through a host region mirroring the virtual memory, and
+ * installs a hook called before every eviction. Passing nullptrs restores the default behavior.
+ * @param region The host region, VIRTUAL_MEMORY_SIZE words long.
+ * @param hook The eviction hook.
+ */
+void setNativeAccess(word_t *region, EvictionHook hook);
+
+/**
+ * This function reads the clock the memory pressure metrics are kept by.
+ * @return The current time, in microseconds.
+ */
+long long int pressureClock();
+
+/**
+ * This function accounts for the time a caller was stalled in a fault, from its start until now.
+ * @param stallStart The time the stall started, by pressureClock.
+ */
+void recordStall(long long int stallStart);
+
+/**
+ * This function resets the memory pressure metrics and restarts the windows of the triggers.
+ */
+void resetPressure();
+
+/**
+ * Optionally provided by a physical memory backend which can zero a whole frame faster than
+ * PAGE_SIZE PMwrite calls (it is null otherwise, with the in-memory PhysicalMemory.cpp).
+ * @param frameIndex The frame.
+ */
+void PMzeroFrame(uint64_t frameIndex) __attribute__((weak));
+
+/**
+ * Optionally provided by a physical memory backend which can start loading a word into the host CPU
+ * caches ahead of a PMread of it (it is null otherwise).
+ * @param physicalAddress The word's address.
+ */
+void PMprefetch(uint64_t physicalAddress) __attribute__((weak));
+
+/**
+ * Optionally provided, together with PMwaitRestores, by a physical memory backend which can have
+ * several restores in flight at once (both are null otherwise). It starts restoring a page like
+ * PMrestore. Until PMwaitRestores returns, the frame is only accessed again by evicting it, which
+ * waits for the restore first.
+ * @param frameIndex The frame.
+ * @param restoredPageIndex The page.
+ */
+void PMqueueRestore(uint64_t frameIndex, uint64_t restoredPageIndex) __attribute__((weak));
+
+/**
+ * Optionally provided with PMqueueRestore: waits until all the restores it started have completed.
+ */
+void PMwaitRestores() __attribute__((weak));